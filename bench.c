@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <sys/wait.h>
+
+#include "udp.h"
+#include "mfs.h"
+#include "server_core.h"
+
+#define MAX_SAMPLES 1000
+#define MIN_SAMPLE_NS 200000 // batch calls until one sample takes >= 200us
+#define LOOKUP_FILES 125
+#define CREATE_BATCH 100
+
+int reps = 30;
+int warmup = 5;
+int max_data = 65536;
+int keep_images = 0;
+char *mkfs_path = "./mkfs";
+char *img_dir = "/tmp";
+FILE *report; // stdout is silenced while the server core runs
+
+char lookup_name[28];
+int lookup_pinum;
+int bench_scale_now; // the scale being timed, for failure reports
+
+void usage()
+{
+    fprintf(stderr, "usage: bench [-r reps] [-w warmup] [-d max_data] [-m mkfs] [-o dir] [-k] scale...\n");
+    exit(1);
+}
+
+// a primitive returned the wrong result: the timings would be meaningless
+void bench_fail(const char *what, int rc)
+{
+    fprintf(stderr, "bench: %s returned %d at %d inodes\n", what, rc, bench_scale_now);
+    exit(1);
+}
+
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+    return (x > y) - (x < y);
+}
+
+void print_summary(int scale, const char *name, double *samples, int n, int batch)
+{
+    qsort(samples, n, sizeof(double), cmp_double);
+
+    double sum = 0, sq = 0;
+    for (int i = 0; i < n; i++)
+        sum += samples[i];
+    double mean = sum / n;
+    for (int i = 0; i < n; i++)
+        sq += (samples[i] - mean) * (samples[i] - mean);
+    double stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+
+    fprintf(report, "%9d  %-22s %6d %6d %13.1f %13.1f %13.1f %13.1f %11.1f\n",
+            scale, name, n, batch, samples[0], samples[n / 2], mean,
+            samples[(int)(n * 0.95)], stddev);
+    fflush(report);
+}
+
+// time `op` in batches: warm up while growing the batch, then take `nreps`
+// samples of the mean per-call cost (ns)
+void run_bench(int scale, const char *name, void (*op)(), int nreps, int fixed_batch)
+{
+    double samples[MAX_SAMPLES];
+    int batch = fixed_batch ? fixed_batch : 1;
+
+    for (int w = 0; w < warmup; w++)
+    {
+        long long start = now_ns();
+        for (int i = 0; i < batch; i++)
+            op();
+        long long elapsed = now_ns() - start;
+        if (!fixed_batch && elapsed < MIN_SAMPLE_NS && batch < (1 << 20))
+            batch *= 2;
+    }
+
+    for (int r = 0; r < nreps; r++)
+    {
+        long long start = now_ns();
+        for (int i = 0; i < batch; i++)
+            op();
+        samples[r] = (double)(now_ns() - start) / batch;
+    }
+    print_summary(scale, name, samples, nreps, batch);
+}
+
+void op_lookup_hit()
+{
+    int inum = server_lookup(lookup_pinum, lookup_name);
+    if (inum <= 0)
+        bench_fail("server_lookup(hit)", inum);
+}
+
+void op_lookup_miss()
+{
+    int inum = server_lookup(lookup_pinum, "no-such-entry");
+    if (inum != -1)
+        bench_fail("server_lookup(miss)", inum);
+}
+
+void op_inum_alloc()
+{
+    get_available_inum();
+}
+
+void op_datablock_alloc()
+{
+    get_available_datablock();
+}
+
+void op_save()
+{
+    int rc = save_server_file();
+    if (rc != 0)
+        bench_fail("save_server_file", rc);
+}
+
+// create/unlink change state, so they are timed as batches of distinct names
+// in the root directory and each batch is undone by the other primitive
+void bench_create_unlink(int scale, int batch)
+{
+    double create_samples[MAX_SAMPLES], unlink_samples[MAX_SAMPLES];
+    char name[28];
+
+    for (int r = -warmup; r < reps; r++)
+    {
+        long long start = now_ns();
+        for (int i = 0; i < batch; i++)
+        {
+            sprintf(name, "b%d", i);
+            int rc = server_create(0, MFS_REGULAR_FILE, name);
+            if (rc != 0)
+                bench_fail("server_create", rc);
+        }
+        long long created = now_ns();
+        for (int i = 0; i < batch; i++)
+        {
+            sprintf(name, "b%d", i);
+            int rc = server_unlink(0, name);
+            if (rc != 0)
+                bench_fail("server_unlink", rc);
+        }
+        long long unlinked = now_ns();
+
+        if (r >= 0)
+        {
+            create_samples[r] = (double)(created - start) / batch;
+            unlink_samples[r] = (double)(unlinked - created) / batch;
+        }
+    }
+    print_summary(scale, "server_create", create_samples, reps, batch);
+    print_summary(scale, "server_unlink", unlink_samples, reps, batch);
+}
+
+// mark every bit but the last one as used, so allocation scans the whole map
+unsigned int *age_bitmap(int bitmap_addr, int bitmap_len, int nbits)
+{
+    unsigned int *bitmap = block_addr_to_addr(bitmap_addr);
+    size_t len = (size_t)bitmap_len * block_size;
+    unsigned int *saved = malloc(len);
+    memcpy(saved, bitmap, len);
+
+    for (int i = 0; i < nbits - 1; i++)
+        set_ith_bit(bitmap, i, 1);
+    set_ith_bit(bitmap, nbits - 1, 0);
+    return saved;
+}
+
+void restore_bitmap(int bitmap_addr, int bitmap_len, unsigned int *saved)
+{
+    memcpy(block_addr_to_addr(bitmap_addr), saved, (size_t)bitmap_len * block_size);
+    free(saved);
+}
+
+int make_image(char *path, int num_inodes, int num_data)
+{
+    char inodes[16], data[16];
+    sprintf(inodes, "%d", num_inodes);
+    sprintf(data, "%d", num_data);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execl(mkfs_path, mkfs_path, "-f", path, "-i", inodes, "-d", data, (char *)NULL);
+        perror("execl");
+        _exit(1);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+void bench_scale(int scale)
+{
+    char path[256];
+    int num_data = scale < 8192 ? 8192 : scale;
+    if (num_data > max_data)
+        num_data = max_data > 8192 ? max_data : 8192;
+
+    snprintf(path, sizeof(path), "%s/mfs-bench-%d.img", img_dir, scale);
+    if (make_image(path, scale, num_data) < 0)
+    {
+        fprintf(stderr, "bench: mkfs failed for %d inodes\n", scale);
+        exit(1);
+    }
+    bench_scale_now = scale;
+    int rc = server_load_image(path);
+    if (rc != 0)
+        bench_fail("server_load_image", rc);
+
+    // a full directory to scan for lookups; small images keep half of their
+    // inodes free for the create/unlink batches
+    rc = server_create(0, MFS_DIRECTORY, "lookup");
+    if (rc != 0)
+        bench_fail("server_create", rc);
+    lookup_pinum = server_lookup(0, "lookup");
+    if (lookup_pinum <= 0)
+        bench_fail("server_lookup", lookup_pinum);
+    int files = LOOKUP_FILES < (scale - 2) / 2 ? LOOKUP_FILES : (scale - 2) / 2;
+    for (int i = 0; i < files; i++)
+    {
+        sprintf(lookup_name, "f%d", i);
+        rc = server_create(lookup_pinum, MFS_REGULAR_FILE, lookup_name);
+        if (rc != 0)
+            bench_fail("server_create", rc);
+    }
+
+    run_bench(scale, "server_lookup(hit)", op_lookup_hit, reps, 0);
+    run_bench(scale, "server_lookup(miss)", op_lookup_miss, reps, 0);
+    run_bench(scale, "inum_alloc", op_inum_alloc, reps, 0);
+    run_bench(scale, "datablock_alloc", op_datablock_alloc, reps, 0);
+
+    unsigned int *saved = age_bitmap(superblock_addr->inode_bitmap_addr,
+                                     superblock_addr->inode_bitmap_len, superblock_addr->num_inodes);
+    run_bench(scale, "inum_alloc(full)", op_inum_alloc, reps, 0);
+    restore_bitmap(superblock_addr->inode_bitmap_addr, superblock_addr->inode_bitmap_len, saved);
+
+    saved = age_bitmap(superblock_addr->data_bitmap_addr,
+                       superblock_addr->data_bitmap_len, superblock_addr->num_data);
+    run_bench(scale, "datablock_alloc(full)", op_datablock_alloc, reps, 0);
+    restore_bitmap(superblock_addr->data_bitmap_addr, superblock_addr->data_bitmap_len, saved);
+
+    int batch = CREATE_BATCH < scale - 2 - files ? CREATE_BATCH : scale - 2 - files;
+    bench_create_unlink(scale, batch);
+
+    run_bench(scale, "save_server_file", op_save, reps < 5 ? reps : 5, 1);
+
+    server_close_image();
+    if (!keep_images)
+        unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "r:w:d:m:o:k")) != -1)
+    {
+        switch (ch)
+        {
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'd':
+            max_data = atoi(optarg);
+            break;
+        case 'm':
+            mkfs_path = optarg;
+            break;
+        case 'o':
+            img_dir = optarg;
+            break;
+        case 'k':
+            keep_images = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind == argc || reps < 1 || reps > MAX_SAMPLES)
+        usage();
+
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    freopen("/dev/null", "w", stdout);
+
+    fprintf(report, "%9s  %-22s %6s %6s %13s %13s %13s %13s %11s\n",
+            "inodes", "primitive", "reps", "batch", "min(ns)", "median(ns)", "mean(ns)", "p95(ns)", "stddev");
+    for (int i = optind; i < argc; i++)
+        bench_scale(atoi(argv[i]));
+
+    return 0;
+}
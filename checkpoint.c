@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "checkpoint.h"
+#include "server_core.h"
+#include "trace.h"
+
+int checkpoint_interval_s = 0;
+long long checkpoint_threshold = 0;
+pid_t checkpoint_pid = -1; // the child writing the image, if any
+long long snapshot_bytes;  // dirty bytes it is writing, back to dirty if it fails
+unsigned long long last_start_ns;
+unsigned long long next_reap_ns;
+
+unsigned long long checkpoint_count = 0;
+unsigned long long checkpoint_failures = 0;
+unsigned long long checkpoint_dirty_bytes = 0;
+unsigned int checkpoint_pause_us = 0;
+unsigned int checkpoint_max_pause_us = 0;
+unsigned int checkpoint_ms = 0;
+
+void checkpoint_init(int interval_s, long long dirty_bytes)
+{
+    checkpoint_interval_s = interval_s;
+    checkpoint_threshold = dirty_bytes;
+    last_start_ns = trace_now_ns();
+}
+
+// called from the main loop and from shm session threads
+void checkpoint_dirty(long long bytes)
+{
+    __atomic_fetch_add(&checkpoint_dirty_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+int checkpoint_due(unsigned long long now)
+{
+    unsigned long long dirty = __atomic_load_n(&checkpoint_dirty_bytes, __ATOMIC_RELAXED);
+    if (checkpoint_pid > 0 || dirty == 0)
+        return 0;
+    if (checkpoint_threshold > 0 && dirty >= checkpoint_threshold)
+        return 1;
+    return checkpoint_interval_s > 0 && now - last_start_ns >= checkpoint_interval_s * 1000000000ULL;
+}
+
+int checkpoint_timeout_ms()
+{
+    unsigned long long now = trace_now_ns();
+    if (checkpoint_pid > 0)
+        return CHECKPOINT_REAP_MS;
+    if (checkpoint_due(now))
+        return 0; // e.g. crossed the threshold while the last one ran
+    if (checkpoint_interval_s == 0 || __atomic_load_n(&checkpoint_dirty_bytes, __ATOMIC_RELAXED) == 0)
+        return -1;
+
+    unsigned long long due_ns = last_start_ns + checkpoint_interval_s * 1000000000ULL;
+    return (int)((due_ns - now) / 1000000 + 1);
+}
+
+void checkpoint_done(int status)
+{
+    unsigned long long dur_ns = trace_now_ns() - last_start_ns;
+    checkpoint_pid = -1;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        checkpoint_count++;
+        checkpoint_ms = dur_ns / 1000000;
+        TRACE(TRACE_INFO, TRACE_SAVE, 0, 0, 0, superblock_addr->num_data, dur_ns);
+        LOG(TRACE_DEBUG, "server:: checkpoint written in %u ms\n", checkpoint_ms);
+        return;
+    }
+
+    checkpoint_failures++;
+    checkpoint_dirty(snapshot_bytes); // not on disk after all
+    TRACE(TRACE_ERROR, TRACE_SAVE, 0, 0, -1, superblock_addr->num_data, dur_ns);
+    LOG(TRACE_ERROR, "server:: checkpoint failed\n");
+}
+
+void checkpoint_poll(pthread_mutex_t *lock)
+{
+    unsigned long long now = trace_now_ns();
+    if (checkpoint_pid > 0)
+    {
+        if (now < next_reap_ns)
+            return;
+        next_reap_ns = now + CHECKPOINT_REAP_MS * 1000000ULL;
+
+        int status;
+        if (waitpid(checkpoint_pid, &status, WNOHANG) == checkpoint_pid)
+            checkpoint_done(status);
+        return;
+    }
+    if (!checkpoint_due(now))
+        return;
+
+    // no session thread is halfway through a request while the lock is held,
+    // so the child's copy of the image is consistent. The dirty count is taken
+    // under the lock too: bytes written after the fork stay dirty for the next.
+    pthread_mutex_lock(lock);
+    unsigned long long start_ns = trace_now_ns();
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(save_server_file() < 0 ? 1 : 0);
+    unsigned long long pause_ns = trace_now_ns() - start_ns;
+    if (pid > 0)
+        snapshot_bytes = __atomic_exchange_n(&checkpoint_dirty_bytes, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(lock);
+
+    last_start_ns = start_ns;
+    if (pid < 0)
+    {
+        checkpoint_failures++;
+        LOG(TRACE_ERROR, "server:: checkpoint fork failed\n");
+        return;
+    }
+
+    checkpoint_pid = pid;
+    next_reap_ns = start_ns + CHECKPOINT_REAP_MS * 1000000ULL;
+    checkpoint_pause_us = pause_ns / 1000;
+    if (checkpoint_pause_us > checkpoint_max_pause_us)
+        checkpoint_max_pause_us = checkpoint_pause_us;
+    TRACE(TRACE_INFO, TRACE_CHECKPOINT, 0, 0, pid, (int)(snapshot_bytes >> 10), pause_ns);
+}
+
+void checkpoint_wait()
+{
+    if (checkpoint_pid <= 0)
+        return;
+
+    int status;
+    if (waitpid(checkpoint_pid, &status, 0) == checkpoint_pid)
+        checkpoint_done(status);
+    checkpoint_pid = -1;
+}
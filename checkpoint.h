@@ -0,0 +1,30 @@
+#ifndef __CHECKPOINT_h__
+#define __CHECKPOINT_h__
+
+#include <pthread.h>
+
+#define CHECKPOINT_REAP_MS (10) // how often a running checkpoint is looked for
+
+// Background checkpoints: a forked child writes the image as it was at the
+// fork while the parent keeps serving. Copying the page tables in fork() is
+// the only pause. One runs every `interval_s` seconds while anything is
+// dirty, or as soon as `dirty_bytes` have changed; 0 turns either trigger off.
+void checkpoint_init(int interval_s, long long dirty_bytes);
+void checkpoint_dirty(long long bytes);
+
+// how long the main loop may sleep before checkpoint_poll has work, or -1
+int checkpoint_timeout_ms();
+// starts a checkpoint when one is due, forking under `lock`, and reaps a
+// finished one
+void checkpoint_poll(pthread_mutex_t *lock);
+// waits for a running checkpoint, before the final save at shutdown
+void checkpoint_wait();
+
+extern unsigned long long checkpoint_count;
+extern unsigned long long checkpoint_failures;
+extern unsigned long long checkpoint_dirty_bytes;   // changed since the last snapshot
+extern unsigned int checkpoint_pause_us;     // the last fork
+extern unsigned int checkpoint_max_pause_us;
+extern unsigned int checkpoint_ms;           // the last checkpoint, fork to fsync
+
+#endif // __CHECKPOINT_h__
@@ -25,7 +25,7 @@ int main(int argc, char *argv[])
     MSG_t msg;
     msg.msg_type = INIT_t;
 
-    rc = UDP_Write(sd, &socket_addr, (char *)&msg, sizeof(MSG_t));
+    rc = UDP_Write(sd, &socket_addr, (char *)&msg, MSG_HEADER_SIZE);
     printf("client:: UDP_Write rc=%d\n", rc);
     if (rc > 0)
     {
@@ -1,74 +1,508 @@
+#define _GNU_SOURCE // memfd_create
+#include <signal.h>
+#include <stddef.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/time.h>
 
 #include "mfs.h"
 #include "udp.c"
+#include "stream.c"
+#include "lz.c"
 #include "msg.h"
+#include "stats.h"
+#include "trace.h"
+#include "shm.h"
 
-#define BUFFER_SIZE 4096
+#define MAX_SERVERS 8
+#define MIN_RTO_US 20000      // retransmission timeout bounds
+#define MAX_RTO_US 1000000    // never wait more than 1s on a dead server
+#define INITIAL_RTO_US 200000 // before the first RTT sample
+#define DOWN_US 500000        // reads avoid a server this long per timeout
+#define MAX_ATTEMPTS 5        // unanswered sends before a UDP request fails
+#define PRIMARY_FAILS 2       // mutation timeouts before the next server is tried
+#define SHM_ATTACH_TRIES 3    // servers without shm never answer SHM_ATTACH_t
+#define MAX_WATCHES 256
+#define WATCH_TTL_MS 30000    // renewed after half of it
+
+typedef struct
+{
+    struct sockaddr_in addr;
+    long long srtt_us; // smoothed round-trip time, 0 until measured
+    long long rttvar_us;
+    int fails;               // consecutive timeouts
+    long long down_until_us; // skipped by reads until then
+} endpoint_t;
 
 // global vars
-struct sockaddr_in socket_addr;
+struct sockaddr_in socket_addr; // the primary's address
 MSG_t request_msg;
 MSG_t response_msg;
 int sd = -1;
+int request_seq = 0;
+int mfs_debug = 0; // MFS_DEBUG set in the environment
+
+endpoint_t servers[MAX_SERVERS];
+int num_servers = 0;
+int primary = 0;     // endpoint that takes mutations
+int fixed_rto_us = 0; // MFS_TIMEOUT_MS overrides the adaptive timeout
+
+char stream_host[256]; // "tcp:host" or "unix:/path" given to MFS_Init
+int stream_port = 0;
+int stream_fd = -1; // persistent session, reopened when it breaks
 
-MSG_t send_request(MSG_t request)
+typedef struct
 {
-    printf("libmfs::  msg sending (type: %d, inum: %d, nbytes: %d; offset: %d; name: %s)\n",
-           request.msg_type, request.inum, request.nbytes, request.offset, (char *)request.name);
+    int used;
+    int pinum;
+    int last_seq;       // of the last event delivered
+    int lapsed;         // the server forgot the registration: losses unknown
+    long long renew_us; // when to register again
+} client_watch_t;
 
-    struct sockaddr_in read_addr;
-    MSG_t response;
+client_watch_t watched[MAX_WATCHES];
+int watch_sd = -1; // events arrive here, apart from replies
+
+int compress_on = 1; // MFS_NO_COMPRESS turns payload compression off
+int server_decompresses = 0;
+lz_adapt_t write_adapt;
+
+int max_file_size = -1; // the server's, from INIT_t; asked once a transfer needs it
+int server_block_size = -1;
+
+shm_ring_t *shm_ring = NULL; // set while a server on this host serves us through it
+int shm_fd = -1;
+
+long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Jacobson/Karels timeout, doubled for every consecutive timeout
+long long endpoint_rto(endpoint_t *ep)
+{
+    if (fixed_rto_us)
+        return fixed_rto_us;
+
+    long long rto = ep->srtt_us ? ep->srtt_us + 4 * ep->rttvar_us : INITIAL_RTO_US;
+    if (rto < MIN_RTO_US)
+        rto = MIN_RTO_US;
+    for (int i = 0; i < ep->fails && i < 6; i++)
+        rto *= 2;
+    return rto < MAX_RTO_US ? rto : MAX_RTO_US;
+}
+
+void endpoint_sample(endpoint_t *ep, long long rtt_us)
+{
+    if (ep->srtt_us == 0)
+    {
+        ep->srtt_us = rtt_us;
+        ep->rttvar_us = rtt_us / 2;
+        return;
+    }
+    long long err = rtt_us - ep->srtt_us;
+    ep->srtt_us += err / 8;
+    ep->rttvar_us += ((err < 0 ? -err : err) - ep->rttvar_us) / 4;
+}
+
+// reads go to the faster of two random healthy servers; if every server
+// timed out recently, the one that comes back first is probed
+int pick_read_endpoint()
+{
+    long long now = now_us();
+    int healthy[MAX_SERVERS];
+    int n = 0;
+    int soonest = 0;
+    for (int i = 0; i < num_servers; i++)
+    {
+        if (servers[i].down_until_us <= now)
+            healthy[n++] = i;
+        if (servers[i].down_until_us < servers[soonest].down_until_us)
+            soonest = i;
+    }
+    if (n == 0)
+        return soonest;
+
+    int a = healthy[rand() % n];
+    int b = healthy[rand() % n];
+    return servers[a].srtt_us <= servers[b].srtt_us ? a : b;
+}
+
+void shm_detach()
+{
+    if (shm_ring != NULL)
+        munmap(shm_ring, sizeof(shm_ring_t));
+    if (shm_fd >= 0)
+        close(shm_fd);
+    shm_ring = NULL;
+    shm_fd = -1;
+}
+
+// one request through the shared ring; returns -1 (and detaches) if the
+// server went away, so the caller can fall back to UDP
+int shm_send(MSG_t *request, MSG_t *response)
+{
+    unsigned int head = shm_ring->req_head;
+    MSG_t *resp = &shm_ring->resp[head % SHM_SLOTS];
+
+    memcpy(&shm_ring->req[head % SHM_SLOTS], request, msg_request_size(request));
+    __atomic_store_n(&shm_ring->req_head, head + 1, __ATOMIC_RELEASE);
+    futex_wake(&shm_ring->req_head);
 
-    // UDP_Write(sd, &socket_addr, (char *)&request, sizeof(MSG_t));
-    // UDP_Read(sd, &read_addr, (char *)&response, sizeof(MSG_t));
+    while (shm_wait_change(&shm_ring->resp_head, head) < 0)
+    {
+        if (kill(shm_ring->server_pid, 0) < 0 && errno == ESRCH)
+        {
+            if (mfs_debug)
+                printf("libmfs::  shm server is gone, back to UDP\n");
+            shm_detach();
+            return -1;
+        }
+    }
+
+    memcpy(response, resp, msg_reply_size(request, resp));
+    return 0;
+}
+
+int stream_connect()
+{
+    if (strncmp(stream_host, "unix:", 5) == 0)
+        return STREAM_Connect_Unix(stream_host + 5);
+    return STREAM_Connect_TCP(stream_host + 4, stream_port);
+}
+
+// one request over the stream session: the kernel retransmits and paces, so
+// we only retry (with backoff) when the session breaks, e.g. on a restart
+void stream_send(MSG_t *request, MSG_t *response)
+{
+    long long backoff_us = MIN_RTO_US;
+
+    for (;; request->attempt++)
+    {
+        if (stream_fd < 0 && (stream_fd = stream_connect()) < 0)
+        {
+            if (mfs_debug)
+                printf("libmfs::  cannot connect to %s, retrying\n", stream_host);
+            usleep(backoff_us);
+            backoff_us = backoff_us * 2 < MAX_RTO_US ? backoff_us * 2 : MAX_RTO_US;
+            continue;
+        }
+
+        if (STREAM_WriteMsg(stream_fd, request, msg_request_size(request)) > 0 &&
+            STREAM_ReadMsg(stream_fd, response) > 0 && response->seq == request->seq)
+            return;
+
+        close(stream_fd);
+        stream_fd = -1;
+    }
+}
+
+// one request over UDP, retransmitted until some server answers it or
+// MAX_ATTEMPTS sends go unanswered; rc is -1 then
+void udp_send(MSG_t *request, MSG_t *response)
+{
+    struct sockaddr_in read_addr;
+    response->rc = -1;
+    response->flags = 0;
+    if (!msg_fits_udp(request))
+        return; // a whole 64K block: only MFS_Read/MFS_Write split those
 
     fd_set read_fdset;
-    int max_retry_time = 5;
-    int retry_cnt = 0;
+    int unanswered = 0;
+    int redirects = 0;
     struct timeval timeout;
-    timeout.tv_sec = 2;
-    timeout.tv_usec = 0;
+
     do
     {
-        FD_ZERO(&read_fdset);
-        FD_SET(sd, &read_fdset);
-        UDP_Write(sd, &socket_addr, (char *)&request, sizeof(MSG_t));
-        int returned_val = select(sd + 1, &read_fdset, NULL, NULL, &timeout);
+        int e = msg_is_read_only(request->msg_type) ? pick_read_endpoint() : primary;
+        endpoint_t *ep = &servers[e];
+        long long sent_us = now_us();
+        long long deadline_us = sent_us + endpoint_rto(ep);
 
-        if (returned_val > 0)
+        UDP_Write(sd, &ep->addr, (char *)request, msg_request_size(request));
+
+        // wait for the matching reply until this attempt's timeout
+        int replied = 0;
+        long long left_us;
+        while (!replied && (left_us = deadline_us - now_us()) > 0)
+        {
+            timeout.tv_sec = left_us / 1000000;
+            timeout.tv_usec = left_us % 1000000;
+            FD_ZERO(&read_fdset);
+            FD_SET(sd, &read_fdset);
+            if (select(sd + 1, &read_fdset, NULL, NULL, &timeout) <= 0)
+                break;
+
+            if (UDP_Read(sd, &read_addr, (char *)response, sizeof(MSG_t)) <= 0)
+                break;
+            replied = response->seq == request->seq; // else a late reply to an earlier request
+        }
+
+        if (replied)
         {
-            if (UDP_Read(sd, &read_addr, (char *)&response, sizeof(MSG_t)) > 0)
-                return response;
-            else
-                retry_cnt++;
+            if (request->attempt == 0) // Karn: no samples from retransmitted requests
+                endpoint_sample(ep, now_us() - sent_us);
+            ep->fails = 0;
+            ep->down_until_us = 0;
+
+            // the server is up but its queues are full: come back when it
+            // says, spread out so that turned-away clients do not return together
+            if (response->flags & MSG_BUSY)
+            {
+                int wait_ms = response->offset > 0 ? response->offset : 1;
+                usleep(wait_ms * 1000 + rand() % (wait_ms * 500 + 1));
+                request->attempt++;
+                continue;
+            }
+
+            // the designated primary turned out to be a backup: try the next one
+            if ((response->flags & MSG_NOT_PRIMARY) && redirects++ < num_servers)
+            {
+                primary = (primary + 1) % num_servers;
+                socket_addr = servers[primary].addr;
+                continue;
+            }
+            return;
         }
-    } while (retry_cnt < max_retry_time);
 
+        ep->fails++;
+        ep->down_until_us = now_us() + (long long)DOWN_US * ep->fails;
+        request->attempt++;
+        unanswered++;
+        if (mfs_debug)
+            printf("libmfs::  no reply from server %d (attempt %d)\n", e, request->attempt);
+
+        // the primary looks dead: move on, and let a backup's MSG_NOT_PRIMARY
+        // pass us along if this one is not it either
+        if (e == primary && ep->fails >= PRIMARY_FAILS && num_servers > 1)
+        {
+            primary = (primary + 1) % num_servers;
+            socket_addr = servers[primary].addr;
+            redirects = 0;
+        }
+    } while (unanswered < MAX_ATTEMPTS);
+
+    response->rc = -1; // what was read last, if anything, was not the reply
+    response->flags = 0;
+}
+
+// sends `request`, which it may compress in place; the reply is in
+// response_msg until the next request
+MSG_t *send_request(MSG_t *request)
+{
+    if (mfs_debug)
+        printf("libmfs::  msg sending (type: %d, inum: %d, nbytes: %d; offset: %d; name: %s)\n",
+               request->msg_type, request->inum, request->nbytes, request->offset, (char *)request->name);
+
+    MSG_t *response = &response_msg;
+    request->seq = ++request_seq;
+    request->attempt = 0;
+    request->flags = 0;
+    if (shm_ring != NULL && shm_send(request, response) == 0)
+        return response; // nothing to gain from compressing shared memory
+
+    // advertised on every request; WRITE data is only compressed once a
+    // reply has shown the server can take it
+    if (compress_on)
+    {
+        request->flags |= MSG_COMPRESS_OK;
+        if (request->msg_type == WRITE_t && server_decompresses)
+            msg_pack(request, request->nbytes, &write_adapt);
+    }
+
+    if (stream_host[0] != '\0')
+        stream_send(request, response);
+    else
+        udp_send(request, response);
+
+    if (response->flags & MSG_COMPRESS_OK)
+        server_decompresses = 1;
+    if (request->msg_type == READ_t && msg_unpack(response, request->nbytes) < 0)
+        response->rc = -1;
     return response;
 }
 
-int MFS_Init(char *hostname, int port)
+// Offer a shared ring to a server on this host. The memfd is named to the
+// server by pid and fd number; it maps it from /proc, so this only works when
+// both run on the same machine. Any failure just leaves us on UDP.
+void shm_try_attach()
+{
+    if (getenv("MFS_NO_SHM") != NULL || num_servers != 1)
+        return; // with replicas, reads are balanced over UDP
+
+    char hostname[sizeof(request_msg.name)];
+    if (gethostname(hostname, sizeof(hostname)) < 0)
+        return;
+    hostname[sizeof(hostname) - 1] = '\0';
+
+    shm_fd = memfd_create("mfs-shm", 0);
+    if (shm_fd < 0 || ftruncate(shm_fd, sizeof(shm_ring_t)) < 0)
+    {
+        shm_detach();
+        return;
+    }
+    shm_ring_t *ring = mmap(NULL, sizeof(shm_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (ring == MAP_FAILED)
+    {
+        shm_detach();
+        return;
+    }
+    ring->client_pid = getpid();
+    ring->token = rand();
+
+    MSG_t attach;
+    memset(&attach, 0, sizeof(MSG_t));
+    attach.msg_type = SHM_ATTACH_t;
+    attach.inum = ring->client_pid;
+    attach.offset = shm_fd;
+    attach.nbytes = ring->token;
+    strcpy(attach.name, hostname);
+
+    // not through send_request: it would retry forever against an older server
+    MSG_t reply;
+    reply.rc = -1;
+    for (int i = 0; i < SHM_ATTACH_TRIES && reply.rc != 0; i++)
+    {
+        attach.seq = ++request_seq;
+        attach.attempt = i;
+        UDP_Write(sd, &servers[0].addr, (char *)&attach, MSG_HEADER_SIZE);
+
+        struct timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = INITIAL_RTO_US;
+        reply.seq = 0;
+        while (reply.seq != attach.seq)
+        {
+            fd_set read_fdset;
+            FD_ZERO(&read_fdset);
+            FD_SET(sd, &read_fdset);
+            struct sockaddr_in read_addr;
+            if (select(sd + 1, &read_fdset, NULL, NULL, &timeout) <= 0 ||
+                UDP_Read(sd, &read_addr, (char *)&reply, sizeof(MSG_t)) <= 0)
+                break;
+        }
+        if (reply.seq != attach.seq)
+            reply.rc = -1;
+    }
+
+    if (reply.rc == 0)
+        shm_ring = ring;
+    else
+        munmap(ring, sizeof(shm_ring_t));
+
+    // the server holds its own mapping now; keep the fd only until then
+    close(shm_fd);
+    shm_fd = -1;
+    if (mfs_debug)
+        printf("libmfs::  shm transport %s\n", shm_ring ? "attached" : "not available");
+}
+
+int add_server(char *hostname, int port)
 {
-    printf("libmfs::  initializing.\n");
+    if (num_servers == MAX_SERVERS)
+        return -1;
+
+    endpoint_t *ep = &servers[num_servers];
+    memset(ep, 0, sizeof(endpoint_t));
+    if (UDP_FillSockAddr(&ep->addr, hostname, port) < 0)
+        return -1;
+    num_servers++;
+    return 0;
+}
+
+int init_socket()
+{
+    mfs_debug = getenv("MFS_DEBUG") != NULL;
+    if (mfs_debug)
+        printf("libmfs::  initializing.\n");
+
+    compress_on = getenv("MFS_NO_COMPRESS") == NULL;
+    server_decompresses = 0;
+    max_file_size = -1;
+    server_block_size = -1;
+    memset(&write_adapt, 0, sizeof(write_adapt));
+
+    char *timeout_ms = getenv("MFS_TIMEOUT_MS");
+    fixed_rto_us = timeout_ms ? atoi(timeout_ms) * 1000 : 0;
+    srand(getpid());
+
+    num_servers = 0;
+    primary = 0;
+    shm_detach();
+    memset(watched, 0, sizeof(watched));
+    if (watch_sd >= 0)
+        close(watch_sd);
+    watch_sd = -1;
+    stream_host[0] = '\0';
+    if (stream_fd >= 0)
+        close(stream_fd);
+    stream_fd = -1;
+    if (sd >= 0)
+        UDP_Close(sd);
     sd = UDP_Open(0);
     if (sd < 0) {
         printf("debug::  init failed, sd=%d\n", sd);
         return -1;
     }
+    return 0;
+}
 
+int MFS_Init(char *hostname, int port)
+{
+    if (init_socket() < 0)
+        return -1;
 
-    int rc = UDP_FillSockAddr(&socket_addr, hostname, port);
+    // stream transport: connected on the first request, like UDP never checks
+    if (strncmp(hostname, "tcp:", 4) == 0 || strncmp(hostname, "unix:", 5) == 0)
+    {
+        if (strlen(hostname) >= sizeof(stream_host))
+            return -1;
+        strcpy(stream_host, hostname);
+        stream_port = port;
+        return 0;
+    }
+
+    int rc = add_server(hostname, port);
     if (rc < 0) {
         printf("debug::  init failed, rc=%d\n", rc);
         return -1;
     }
-        
+    socket_addr = servers[primary].addr;
+    shm_try_attach();
+
     // request_msg.msg_type = INIT_t;
     return 0;
 }
 
+int MFS_Init_Servers(char *server_list)
+{
+    if (init_socket() < 0)
+        return -1;
+
+    char list[512];
+    snprintf(list, sizeof(list), "%s", server_list);
+    char *save;
+    for (char *item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        char *colon = strrchr(item, ':');
+        if (colon == NULL)
+            return -1;
+        *colon = '\0';
+        if (add_server(item, atoi(colon + 1)) < 0) {
+            printf("debug::  init failed for %s\n", item);
+            return -1;
+        }
+    }
+    if (num_servers == 0)
+        return -1;
+
+    socket_addr = servers[primary].addr;
+    shm_try_attach();
+    return 0;
+}
+
 int MFS_Lookup(int pinum, char *name)
 {
     if (sd < 0 || strlen(name) > 28)
@@ -77,7 +511,7 @@ int MFS_Lookup(int pinum, char *name)
     request_msg.inum = pinum;
     strcpy((char *)request_msg.name, name);
     request_msg.msg_type = LOOKUP_t;
-    return send_request(request_msg).rc;
+    return send_request(&request_msg)->rc;
 }
 
 int MFS_Stat(int inum, MFS_Stat_t *m)
@@ -88,39 +522,94 @@ int MFS_Stat(int inum, MFS_Stat_t *m)
     request_msg.inum = inum;
     request_msg.msg_type = STAT_t;
 
-    response_msg = send_request(request_msg);
-    m->size = response_msg.nbytes;
-    m->type = response_msg.type;
-    return response_msg.rc;
+    MSG_t *response = send_request(&request_msg);
+    m->size = response->nbytes;
+    m->type = response->type;
+    return response->rc;
+}
+
+// classic images stop at 30 blocks of 4K; others (mkfs -x, -b) go further
+// and take larger transfers, so past those the server is asked once
+int file_size_limit()
+{
+    if (max_file_size < 0)
+    {
+        request_msg.msg_type = INIT_t;
+        MSG_t *response = send_request(&request_msg);
+        if (response->rc < 0)
+            return 30 * MFS_BLOCK_SIZE;
+        max_file_size = response->nbytes;
+        server_block_size = response->offset > 0 ? response->offset : MFS_BLOCK_SIZE;
+    }
+    return max_file_size;
+}
+
+int MFS_BlockSize()
+{
+    if (sd < 0)
+        return -1;
+    file_size_limit();
+    return server_block_size;
+}
+
+// READ/WRITE bytes per request: datagrams cannot carry a whole 64K block,
+// so over UDP it goes in pieces, each at its own offset within the block
+int io_chunk(int nbytes)
+{
+    return stream_host[0] == '\0' && shm_ring == NULL && nbytes > MSG_UDP_IO_MAX ? MSG_UDP_IO_MAX : nbytes;
 }
 
 int MFS_Write(int inum, char *buffer, int offset, int nbytes)
 {
-    if (sd < 0 || offset / BUFFER_SIZE >= 30 || (nbytes < 0 || nbytes > BUFFER_SIZE))
+    if (sd < 0 || offset < 0 || (nbytes < 0 || nbytes > MSG_MAX_PAYLOAD))
+        return -1;
+    if (offset / MFS_BLOCK_SIZE >= 30 && offset >= file_size_limit())
+        return -1;
+    if (nbytes > MFS_BLOCK_SIZE && nbytes > MFS_BlockSize())
         return -1;
 
-    request_msg.inum = inum;
-    memcpy((char *)request_msg.buffer, buffer, BUFFER_SIZE);
-    request_msg.nbytes = nbytes;
-    request_msg.offset = offset;
-    request_msg.msg_type = WRITE_t;
+    int chunk = io_chunk(nbytes);
+    int done = 0;
+    do
+    {
+        int n = nbytes - done < chunk ? nbytes - done : chunk;
+        request_msg.inum = inum;
+        memcpy((char *)request_msg.buffer, buffer + done, n);
+        request_msg.nbytes = n;
+        request_msg.offset = offset + done;
+        request_msg.msg_type = WRITE_t;
 
-    return send_request(request_msg).rc;
+        int rc = send_request(&request_msg)->rc;
+        if (rc < 0)
+            return rc;
+        done += n;
+    } while (done < nbytes);
+    return 0;
 }
 
 int MFS_Read(int inum, char *buffer, int offset, int nbytes)
 {
-    if (sd < 0)
+    if (sd < 0 || nbytes > MSG_MAX_PAYLOAD)
         return -1;
 
-    request_msg.inum = inum;
-    request_msg.nbytes = nbytes;
-    request_msg.offset = offset;
-    request_msg.msg_type = READ_t;
+    int chunk = io_chunk(nbytes);
+    int done = 0;
+    do
+    {
+        int n = nbytes - done < chunk ? nbytes - done : chunk;
+        request_msg.inum = inum;
+        request_msg.nbytes = n;
+        request_msg.offset = offset + done;
+        request_msg.msg_type = READ_t;
 
-    response_msg = send_request(request_msg);
-    memcpy(buffer, response_msg.buffer, MFS_BLOCK_SIZE);
-    return response_msg.rc;
+        MSG_t *response = send_request(&request_msg);
+        if (response->rc < 0)
+            return response->rc;
+        // a whole classic block for anything up to one, as always
+        memcpy(buffer + done, response->buffer, nbytes <= MFS_BLOCK_SIZE ? MFS_BLOCK_SIZE : n);
+        done += n;
+    } while (done < nbytes);
+    return 0;
 }
 
 int MFS_Creat(int pinum, int type, char *name)
@@ -132,7 +621,7 @@ int MFS_Creat(int pinum, int type, char *name)
     request_msg.type = type;
     strcpy((char *)request_msg.name, name);
     request_msg.msg_type = CREAT_t;
-    return send_request(request_msg).rc;
+    return send_request(&request_msg)->rc;
 }
 
 int MFS_Unlink(int pinum, char *name)
@@ -144,7 +633,7 @@ int MFS_Unlink(int pinum, char *name)
     strcpy((char *)request_msg.name, name);
     request_msg.msg_type = UNLINK_t;
 
-    return send_request(request_msg).rc;
+    return send_request(&request_msg)->rc;
 }
 
 int MFS_Shutdown()
@@ -153,5 +642,193 @@ int MFS_Shutdown()
         return -1;
     
     request_msg.msg_type = SHUTDOWN_t;
-    return send_request(request_msg).rc;
-}
\ No newline at end of file
+    return send_request(&request_msg)->rc;
+}
+
+int MFS_Copy(int src_inum, int dst_inum, int offset, int len)
+{
+    if (sd < 0)
+        return -1;
+
+    request_msg.inum = src_inum;
+    request_msg.type = dst_inum;
+    request_msg.offset = offset;
+    request_msg.nbytes = len;
+    request_msg.msg_type = COPY_t;
+    return send_request(&request_msg)->rc;
+}
+
+int MFS_Clone(int src_inum, int dst_inum, int offset, int len)
+{
+    if (sd < 0)
+        return -1;
+
+    request_msg.inum = src_inum;
+    request_msg.type = dst_inum;
+    request_msg.offset = offset;
+    request_msg.nbytes = len;
+    request_msg.msg_type = CLONE_t;
+    return send_request(&request_msg)->rc;
+}
+
+int MFS_Stats(MFS_Stats_t *s)
+{
+    if (sd < 0)
+        return -1;
+
+    request_msg.msg_type = STATS_t;
+
+    MSG_t *response = send_request(&request_msg);
+    memcpy(s, response->buffer, sizeof(MFS_Stats_t));
+    return response->rc;
+}
+
+client_watch_t *find_watch(int pinum)
+{
+    for (int i = 0; i < MAX_WATCHES; i++)
+    {
+        if (watched[i].used && watched[i].pinum == pinum)
+            return &watched[i];
+    }
+    return NULL;
+}
+
+// events are datagrams to watch_sd, so registration always goes over UDP
+int watch_register(int pinum, int ttl_ms, MSG_t *response)
+{
+    if (num_servers == 0)
+        return -1; // stream session only
+
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    if (getsockname(watch_sd, (struct sockaddr *)&local, &len) < 0)
+        return -1;
+
+    MSG_t request;
+    memset(&request, 0, MSG_HEADER_SIZE);
+    request.msg_type = WATCH_t;
+    request.inum = pinum;
+    request.offset = ntohs(local.sin_port);
+    request.nbytes = ttl_ms;
+    request.seq = ++request_seq;
+    udp_send(&request, response);
+    return response->rc;
+}
+
+int MFS_Watch(int pinum)
+{
+    if (sd < 0)
+        return -1;
+    if (watch_sd < 0 && (watch_sd = UDP_Open(0)) < 0)
+        return -1;
+
+    MSG_t response;
+    if (watch_register(pinum, WATCH_TTL_MS, &response) < 0)
+        return -1;
+
+    client_watch_t *w = find_watch(pinum);
+    if (w == NULL)
+    {
+        for (int i = 0; i < MAX_WATCHES && w == NULL; i++)
+        {
+            if (!watched[i].used)
+                w = &watched[i];
+        }
+        if (w == NULL)
+            return -1;
+        w->used = 1;
+        w->pinum = pinum;
+        w->last_seq = response.nbytes;
+        w->lapsed = 0;
+    }
+    else if (response.type) // registered anew: whatever happened meanwhile is lost
+    {
+        w->last_seq = response.nbytes;
+        w->lapsed = 1;
+    }
+    w->renew_us = now_us() + WATCH_TTL_MS * 1000LL / 2;
+    return 0;
+}
+
+int MFS_Unwatch(int pinum)
+{
+    client_watch_t *w = find_watch(pinum);
+    if (sd < 0 || w == NULL)
+        return -1;
+
+    w->used = 0;
+    MSG_t response;
+    return watch_register(pinum, -1, &response);
+}
+
+int MFS_WatchEvent(MFS_WatchEvent_t *ev, int timeout_ms)
+{
+    if (watch_sd < 0)
+        return -1;
+
+    long long deadline_us = timeout_ms < 0 ? -1 : now_us() + timeout_ms * 1000LL;
+    while (1)
+    {
+        // renew registrations that are due, and wake up for the next one
+        long long wake_us = deadline_us;
+        for (int i = 0; i < MAX_WATCHES; i++)
+        {
+            if (!watched[i].used)
+                continue;
+            if (watched[i].renew_us <= now_us())
+                MFS_Watch(watched[i].pinum);
+            if (wake_us < 0 || watched[i].renew_us < wake_us)
+                wake_us = watched[i].renew_us;
+        }
+
+        struct timeval timeout;
+        long long left_us = wake_us < 0 ? 0 : wake_us - now_us();
+        if (left_us < 0)
+            left_us = 0;
+        timeout.tv_sec = left_us / 1000000;
+        timeout.tv_usec = left_us % 1000000;
+
+        fd_set read_fdset;
+        FD_ZERO(&read_fdset);
+        FD_SET(watch_sd, &read_fdset);
+        int rc = select(watch_sd + 1, &read_fdset, NULL, NULL, wake_us < 0 ? NULL : &timeout);
+        if (rc < 0 && errno != EINTR)
+            return -1;
+        if (rc <= 0)
+        {
+            if (deadline_us >= 0 && now_us() >= deadline_us)
+                return 0;
+            continue;
+        }
+
+        watch_event_t wev;
+        struct sockaddr_in from;
+        if (UDP_Read(watch_sd, &from, (char *)&wev, sizeof(wev)) != sizeof(wev) || wev.msg_type != WATCH_EVENT_t)
+            continue;
+
+        client_watch_t *w = find_watch(wev.pinum);
+        if (w == NULL || wev.seq <= w->last_seq)
+            continue; // unwatched since, or a late duplicate
+
+        ev->pinum = wev.pinum;
+        ev->event = wev.event;
+        ev->inum = wev.inum;
+        memcpy(ev->name, wev.name, sizeof(ev->name));
+        ev->name[sizeof(ev->name) - 1] = '\0';
+        ev->lost = w->lapsed ? -1 : wev.seq - w->last_seq - 1;
+        w->last_seq = wev.seq;
+        w->lapsed = 0;
+        return 1;
+    }
+}
+
+int MFS_Trace(int level, int dump)
+{
+    if (sd < 0)
+        return -1;
+
+    request_msg.type = level;
+    request_msg.nbytes = dump;
+    request_msg.msg_type = TRACE_t;
+    return send_request(&request_msg)->rc;
+}
@@ -0,0 +1,180 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS (12)
+#define LZ_MIN_MATCH (4)
+#define LZ_MAX_MATCH (0x3f + LZ_MIN_MATCH)
+#define LZ_MIN_ZEROS (8) // shorter zero runs are cheaper as literals or matches
+#define LZ_MAX_ZEROS (0x4000)
+#define LZ_MAX_DIST (0xffff)
+
+static uint32_t read32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static int emit_literals(const char *in, int n, char *out, int op, int cap)
+{
+    while (n > 0)
+    {
+        int run = n < 128 ? n : 128;
+        if (op + 1 + run > cap)
+            return -1;
+        out[op++] = run - 1;
+        memcpy(out + op, in, run);
+        op += run;
+        in += run;
+        n -= run;
+    }
+    return op;
+}
+
+int lz_compress(const char *in, int n, char *out, int cap)
+{
+    int table[1 << LZ_HASH_BITS]; // last position + 1 of each 4-byte hash
+    memset(table, 0, sizeof(table));
+
+    int op = 0;
+    int anchor = 0; // first byte not yet emitted
+    int i = 0;
+    while (i < n && op >= 0)
+    {
+        if (in[i] == 0)
+        {
+            int zeros = 1;
+            while (i + zeros < n && in[i + zeros] == 0 && zeros < LZ_MAX_ZEROS)
+                zeros++;
+            if (zeros >= LZ_MIN_ZEROS)
+            {
+                op = emit_literals(in + anchor, i - anchor, out, op, cap);
+                if (op < 0 || op + 2 > cap)
+                    return -1;
+                out[op++] = 0xc0 | ((zeros - 1) >> 8);
+                out[op++] = (zeros - 1) & 0xff;
+                i += zeros;
+                anchor = i;
+                continue;
+            }
+        }
+
+        if (i + LZ_MIN_MATCH <= n)
+        {
+            uint32_t h = (read32(in + i) * 2654435761u) >> (32 - LZ_HASH_BITS);
+            int cand = table[h] - 1;
+            table[h] = i + 1;
+            if (cand >= 0 && i - cand <= LZ_MAX_DIST && read32(in + cand) == read32(in + i))
+            {
+                int len = LZ_MIN_MATCH;
+                while (i + len < n && len < LZ_MAX_MATCH && in[cand + len] == in[i + len])
+                    len++;
+
+                op = emit_literals(in + anchor, i - anchor, out, op, cap);
+                if (op < 0 || op + 3 > cap)
+                    return -1;
+                out[op++] = 0x80 | (len - LZ_MIN_MATCH);
+                out[op++] = (i - cand) & 0xff;
+                out[op++] = (i - cand) >> 8;
+                i += len;
+                anchor = i;
+                continue;
+            }
+        }
+        i++;
+    }
+    if (op < 0)
+        return -1;
+    return emit_literals(in + anchor, n - anchor, out, op, cap);
+}
+
+int lz_decompress(const char *in, int n, char *out, int cap)
+{
+    const unsigned char *ip = (const unsigned char *)in;
+    int i = 0;
+    int op = 0;
+    while (i < n)
+    {
+        int c = ip[i++];
+        if (c < 0x80)
+        {
+            int len = c + 1;
+            if (i + len > n || op + len > cap)
+                return -1;
+            memcpy(out + op, ip + i, len);
+            i += len;
+            op += len;
+        }
+        else if (c < 0xc0)
+        {
+            int len = (c & 0x3f) + LZ_MIN_MATCH;
+            if (i + 2 > n)
+                return -1;
+            int dist = ip[i] | ip[i + 1] << 8;
+            i += 2;
+            if (dist == 0 || dist > op || op + len > cap)
+                return -1;
+            for (int k = 0; k < len; k++) // may overlap its own output
+                out[op + k] = out[op - dist + k];
+            op += len;
+        }
+        else
+        {
+            if (i + 1 > n)
+                return -1;
+            int len = ((c & 0x3f) << 8 | ip[i++]) + 1;
+            if (op + len > cap)
+                return -1;
+            memset(out + op, 0, len);
+            op += len;
+        }
+    }
+    return op;
+}
+
+int msg_pack(MSG_t *msg, int nbytes, lz_adapt_t *adapt)
+{
+    nbytes = msg_payload(nbytes);
+    if (nbytes < LZ_MIN_INPUT)
+        return LZ_SKIPPED;
+    if (adapt->skip > 0)
+    {
+        adapt->skip--;
+        return LZ_SKIPPED;
+    }
+
+    char packed[sizeof(msg->buffer)];
+    int zbytes = lz_compress(msg->buffer, nbytes, packed, nbytes - nbytes / 8);
+    if (zbytes < 0)
+    {
+        adapt->backoff = adapt->backoff ? adapt->backoff * 2 : 1;
+        if (adapt->backoff > LZ_MAX_BACKOFF)
+            adapt->backoff = LZ_MAX_BACKOFF;
+        adapt->skip = adapt->backoff;
+        return LZ_RAW;
+    }
+
+    adapt->backoff = 0;
+    memcpy(msg->buffer, packed, zbytes);
+    msg->zbytes = zbytes;
+    msg->flags |= MSG_COMPRESSED;
+    return LZ_PACKED;
+}
+
+int msg_unpack(MSG_t *msg, int nbytes)
+{
+    if (!(msg->flags & MSG_COMPRESSED))
+        return 0;
+
+    nbytes = msg_payload(nbytes);
+    char raw[sizeof(msg->buffer)];
+    if (msg->zbytes < 0 || msg->zbytes > (int)sizeof(msg->buffer) ||
+        lz_decompress(msg->buffer, msg->zbytes, raw, nbytes) != nbytes)
+        return -1;
+
+    memcpy(msg->buffer, raw, nbytes);
+    msg->flags &= ~MSG_COMPRESSED;
+    return 0;
+}
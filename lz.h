@@ -0,0 +1,35 @@
+#ifndef __LZ_h__
+#define __LZ_h__
+
+#include "msg.h"
+
+// Byte-oriented LZ77 with zero-run elision, for READ/WRITE payloads. Tokens:
+//   0x00-0x7f  literal run of (c + 1) bytes, which follow
+//   0x80-0xbf  match of (c & 0x3f) + 4 bytes, 2-byte little-endian distance
+//   0xc0-0xff  ((c & 0x3f) << 8 | next byte) + 1 zero bytes
+
+#define LZ_MIN_INPUT (64)  // smaller payloads are sent as they are
+#define LZ_MAX_BACKOFF (64) // payloads skipped after repeated misses
+
+// returns the compressed size, or -1 if it would exceed `cap`
+int lz_compress(const char *in, int n, char *out, int cap);
+// returns the decompressed size, or -1 for malformed input or overflow
+int lz_decompress(const char *in, int n, char *out, int cap);
+
+// Compression is skipped for a growing number of payloads after it fails to
+// save an eighth of the bytes, so incompressible data costs almost nothing.
+typedef struct {
+    int skip;    // payloads left to send raw
+    int backoff; // next skip after a miss
+} lz_adapt_t;
+
+#define LZ_PACKED (1)   // buffer now holds zbytes of compressed payload
+#define LZ_RAW (0)      // tried, did not pay
+#define LZ_SKIPPED (-1) // not tried
+
+// compress the first `nbytes` of msg->buffer in place (sets MSG_COMPRESSED)
+int msg_pack(MSG_t *msg, int nbytes, lz_adapt_t *adapt);
+// undo msg_pack into `nbytes` raw bytes; -1 if the payload is corrupt
+int msg_unpack(MSG_t *msg, int nbytes);
+
+#endif // __LZ_h__
@@ -1,30 +1,59 @@
-#ifndef __MFS_h__
-#define __MFS_h__
-
-#define MFS_DIRECTORY    (0)
-#define MFS_REGULAR_FILE (1)
-
-#define MFS_BLOCK_SIZE   (4096)
-
-typedef struct __MFS_Stat_t {
-    int type;   // MFS_DIRECTORY or MFS_REGULAR
-    int size;   // bytes
-    // note: no permissions, access times, etc.
-} MFS_Stat_t;
-
-typedef struct __MFS_DirEnt_t {
-    char name[28];  // up to 28 bytes of name in directory (including \0)
-    int  inum;      // inode number of entry (-1 means entry not used)
-} MFS_DirEnt_t;
-
-
-int MFS_Init(char *hostname, int port);
-int MFS_Lookup(int pinum, char *name);
-int MFS_Stat(int inum, MFS_Stat_t *m);
-int MFS_Write(int inum, char *buffer, int offset, int nbytes);
-int MFS_Read(int inum, char *buffer, int offset, int nbytes);
-int MFS_Creat(int pinum, int type, char *name);
-int MFS_Unlink(int pinum, char *name);
-int MFS_Shutdown();
-
-#endif // __MFS_h__
+#ifndef __MFS_h__
+#define __MFS_h__
+
+#define MFS_DIRECTORY    (0)
+#define MFS_REGULAR_FILE (1)
+
+#define MFS_BLOCK_SIZE   (4096)
+#define MFS_MAX_BLOCK_SIZE (65536) // images made with mkfs -b
+
+typedef struct __MFS_Stat_t {
+    int type;   // MFS_DIRECTORY or MFS_REGULAR
+    int size;   // bytes
+    // note: no permissions, access times, etc.
+} MFS_Stat_t;
+
+typedef struct __MFS_DirEnt_t {
+    char name[28];  // up to 28 bytes of name in directory (including \0)
+    int  inum;      // inode number of entry (-1 means entry not used)
+} MFS_DirEnt_t;
+
+
+int MFS_Init(char *hostname, int port); // "tcp:host" or "unix:/path" for a stream session
+int MFS_Init_Servers(char *server_list); // "primary:port,replica:port,..."
+int MFS_Lookup(int pinum, char *name);
+int MFS_Stat(int inum, MFS_Stat_t *m);
+int MFS_Write(int inum, char *buffer, int offset, int nbytes);
+int MFS_Read(int inum, char *buffer, int offset, int nbytes);
+int MFS_Creat(int pinum, int type, char *name);
+int MFS_Unlink(int pinum, char *name);
+int MFS_Shutdown();
+
+// the image's block size: the most one MFS_Read/MFS_Write moves, within one
+// block. Above MFS_BLOCK_SIZE, transfers may start anywhere in a block.
+int MFS_BlockSize();
+
+// copy bytes [offset, offset + len) of src_inum into dst_inum, on the server;
+// MFS_Clone shares whole blocks until either file writes them
+int MFS_Copy(int src_inum, int dst_inum, int offset, int len);
+int MFS_Clone(int src_inum, int dst_inum, int offset, int len);
+
+#define MFS_WATCH_CREATED (1)
+#define MFS_WATCH_REMOVED (2)
+
+typedef struct __MFS_WatchEvent_t {
+    int pinum;     // watched directory
+    int event;     // MFS_WATCH_CREATED or MFS_WATCH_REMOVED
+    int inum;
+    char name[28];
+    int lost;      // events missed on this directory just before this one
+} MFS_WatchEvent_t;
+
+// receive events for directory pinum until MFS_Unwatch; libmfs renews the
+// registration while MFS_WatchEvent is called. MFS_WatchEvent returns 1 with
+// an event, 0 after timeout_ms (-1: wait forever) and -1 on error.
+int MFS_Watch(int pinum);
+int MFS_Unwatch(int pinum);
+int MFS_WatchEvent(MFS_WatchEvent_t *ev, int timeout_ms);
+
+#endif // __MFS_h__
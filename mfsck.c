@@ -0,0 +1,647 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ufs.h"
+
+#define CHUNK 4096           // inodes or data blocks handed to a thread at a time
+
+// exit codes, as fsck(8)
+#define FSCK_OK 0
+#define FSCK_REPAIRED 1
+#define FSCK_ERRORS 4
+#define FSCK_FAILED 8
+
+enum
+{
+    P_INODE,     // allocated inode with a bad type, or a directory with a bad size
+    P_SIZE,      // file size past the end of its blocks
+    P_POINTER,   // block pointer outside the data region
+    P_DUP_PTR,   // one file pointing at a block twice
+    P_DOUBLE,    // directory or indirect block also used elsewhere
+    P_ENTRY,     // directory entry naming a free or broken inode
+    P_LINKED,    // inode named by more than one entry
+    P_DOT,       // "." or ".." wrong
+    P_DIRSIZE,   // directory size does not match its entries
+    P_ORPHAN,    // allocated but unreachable from the root
+    P_IBITMAP,   // reachable inode not marked in the inode bitmap
+    P_LEAKED,    // data bitmap bit set, no inode uses the block
+    P_UNMARKED,  // block in use, data bitmap bit clear
+    P_KINDS
+};
+
+char *problem_names[P_KINDS] = {
+    [P_INODE] = "bad inodes",
+    [P_SIZE] = "file sizes past their blocks",
+    [P_POINTER] = "bad block pointers",
+    [P_DUP_PTR] = "blocks used twice by one file",
+    [P_DOUBLE] = "double-allocated directory or indirect blocks",
+    [P_ENTRY] = "dangling directory entries",
+    [P_LINKED] = "inodes linked more than once",
+    [P_DOT] = "bad . or .. entries",
+    [P_DIRSIZE] = "wrong directory sizes",
+    [P_ORPHAN] = "orphaned inodes",
+    [P_IBITMAP] = "unmarked inodes",
+    [P_LEAKED] = "leaked data blocks",
+    [P_UNMARKED] = "unmarked data blocks",
+};
+
+super_t *sb;
+inode_t *inodes;
+unsigned int *inode_bitmap;
+unsigned int *data_bitmap;
+dir_ent_t *data_region;
+int nthreads;
+int ext_format; // mkfs -x: direct[28] and direct[29] are indirect
+int block_size; // mkfs -b, else UFS_BLOCK_SIZE
+int entries_per_block;
+int verbose = 0;
+int max_reports = 10; // messages printed per kind of problem
+
+// per data block: pointers to it, how many of those hold directory entries
+// or block pointers, and the last inode (+1) repair kept pointing at it
+unsigned int *refs;
+unsigned int *meta_refs;
+int *owner;
+// per inode
+unsigned char *bad;     // unusable: its entries get dropped on repair
+unsigned char *reached; // from inode 0
+int *links;             // entries naming it, "." and ".." aside
+
+unsigned long long problems[P_KINDS];
+unsigned long long shared_blocks; // cloned files share blocks legitimately
+pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void usage()
+{
+    fprintf(stderr, "usage: mfsck [-r] [-j threads] [-v] image_file\n");
+    exit(FSCK_FAILED);
+}
+
+void problem(int kind, char *fmt, ...)
+{
+    unsigned long long n = __atomic_add_fetch(&problems[kind], 1, __ATOMIC_RELAXED);
+    if (!verbose && n > max_reports)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    pthread_mutex_lock(&report_lock);
+    vprintf(fmt, ap);
+    printf("\n");
+    pthread_mutex_unlock(&report_lock);
+    va_end(ap);
+}
+
+int get_bit(unsigned int *bitmap, int i)
+{
+    return (bitmap[i / 32] >> (31 - i % 32)) & 0x1;
+}
+
+void set_bit(unsigned int *bitmap, int i, int val)
+{
+    if (val)
+        bitmap[i / 32] |= 0x1u << (31 - i % 32);
+    else
+        bitmap[i / 32] &= ~(0x1u << (31 - i % 32));
+}
+
+// data block index of a pointer, or -1 if it is not one
+int block_index(unsigned int ptr)
+{
+    long long idx = (long long)ptr - sb->data_region_addr;
+    return ptr != -1 && idx >= 0 && idx < sb->num_data ? (int)idx : -1;
+}
+
+dir_ent_t *dir_entries(int inum)
+{
+    return data_region + (size_t)block_index(inodes[inum].direct[0]) * entries_per_block;
+}
+
+// an indirect block's pointers
+unsigned int *block_ptrs(int idx)
+{
+    return (unsigned int *)(data_region + (size_t)idx * entries_per_block);
+}
+
+// the geometry mkfs writes, checked against the file before anything is
+// dereferenced
+int check_super(off_t file_size)
+{
+    long long bits = 8LL * block_size;
+    if (sb->num_inodes < 1 || sb->num_data < 1 ||
+        sb->inode_bitmap_len * bits < sb->num_inodes || sb->data_bitmap_len * bits < sb->num_data ||
+        (long long)sb->inode_region_len * block_size < (long long)sb->num_inodes * sizeof(inode_t) ||
+        sb->data_region_len < sb->num_data || sb->inode_bitmap_addr < 1 ||
+        sb->data_bitmap_addr < sb->inode_bitmap_addr + sb->inode_bitmap_len ||
+        sb->inode_region_addr < sb->data_bitmap_addr + sb->data_bitmap_len ||
+        sb->data_region_addr < sb->inode_region_addr + sb->inode_region_len)
+        return -1;
+    return ((off_t)sb->data_region_addr + sb->num_data) * block_size <= file_size ? 0 : -1;
+}
+
+// runs fn over [0, n) on nthreads threads, CHUNK items at a time
+typedef void (*range_fn)(int from, int to);
+
+struct
+{
+    range_fn fn;
+    int n;
+    int next;
+} work;
+
+void *worker(void *arg)
+{
+    int from;
+    while ((from = __atomic_fetch_add(&work.next, CHUNK, __ATOMIC_RELAXED)) < work.n)
+        work.fn(from, from + CHUNK < work.n ? from + CHUNK : work.n);
+    return NULL;
+}
+
+void parallel_for(int n, range_fn fn)
+{
+    work.fn = fn;
+    work.n = n;
+    work.next = 0;
+
+    pthread_t tids[nthreads];
+    for (int t = 1; t < nthreads; t++)
+        pthread_create(&tids[t], NULL, worker, NULL);
+    worker(NULL);
+    for (int t = 1; t < nthreads; t++)
+        pthread_join(tids[t], NULL);
+}
+
+// the blocks one inode points at, as an open-addressed hash set. Slots whose
+// stamp is not the inode's (+1) are empty, so moving on to the next inode
+// needs no clearing. Each thread checks its inodes with a set of its own.
+typedef struct
+{
+    int *block;
+    int *stamp;
+    int cap; // a power of two
+    int used;
+    int inum;
+} block_set_t;
+
+void block_set_reset(block_set_t *set, int inum)
+{
+    set->inum = inum + 1;
+    set->used = 0;
+}
+
+int *block_set_slot(block_set_t *set, int idx)
+{
+    unsigned int h = (unsigned int)idx * 2654435761u;
+    for (;; h++)
+    {
+        int *slot = &set->block[h & (set->cap - 1)];
+        if (set->stamp[h & (set->cap - 1)] != set->inum || *slot == idx)
+            return slot;
+    }
+}
+
+// adds `idx` to the blocks of the inode being checked; 0 if it was there
+int block_set_add(block_set_t *set, int idx)
+{
+    if (2 * (set->used + 1) > set->cap)
+    {
+        block_set_t old = *set;
+        set->cap = old.cap ? 2 * old.cap : 64;
+        set->block = malloc(sizeof(int) * set->cap);
+        set->stamp = calloc(set->cap, sizeof(int));
+        for (int i = 0; i < old.cap; i++)
+        {
+            if (old.stamp[i] == set->inum)
+            {
+                int *slot = block_set_slot(set, old.block[i]);
+                *slot = old.block[i];
+                set->stamp[slot - set->block] = set->inum;
+            }
+        }
+        free(old.block);
+        free(old.stamp);
+    }
+
+    int *slot = block_set_slot(set, idx);
+    if (set->stamp[slot - set->block] == set->inum)
+        return 0;
+    *slot = idx;
+    set->stamp[slot - set->block] = set->inum;
+    set->used++;
+    return 1;
+}
+
+// counts the pointer in `slot` of inode `inum` and, `depth` levels of
+// block pointers down, the ones below it. `seen` holds the blocks already
+// counted for this inode.
+void check_pointer(int inum, unsigned int *slot, int depth, int meta, char *where, block_set_t *seen)
+{
+    if (*slot == -1)
+        return;
+    int idx = block_index(*slot);
+    if (idx < 0)
+    {
+        problem(P_POINTER, "inode %d: %s = %d is not a data block", inum, where, (int)*slot);
+        return;
+    }
+    if (!block_set_add(seen, idx))
+    {
+        problem(P_DUP_PTR, "inode %d: %s repeats block %d", inum, where, idx);
+        return;
+    }
+
+    __atomic_fetch_add(&refs[idx], 1, __ATOMIC_RELAXED);
+    if (meta || depth > 0)
+        __atomic_fetch_add(&meta_refs[idx], 1, __ATOMIC_RELAXED);
+    if (depth > 0)
+    {
+        unsigned int *ptrs = block_ptrs(idx);
+        for (int k = 0; k < INDIRECT_PTRS(block_size); k++)
+            check_pointer(inum, &ptrs[k], depth - 1, 0, "an indirect pointer", seen);
+    }
+}
+
+// bytes up to the end of the last data block `ino` points at. A 4K image
+// writes each transfer at the start of its block, so there a file's size may
+// run up to a block past that.
+long long mapped_extent(inode_t *ino)
+{
+    int n = INDIRECT_PTRS(block_size);
+    long long blocks = 0;
+    if (!ext_format)
+    {
+        for (int j = DIRECT_PTRS; j > 0 && blocks == 0; j--)
+            blocks = block_index(ino->direct[j - 1]) >= 0 ? j : 0;
+        return blocks * block_size;
+    }
+
+    int idx = block_index(ino->direct[EXT_DOUBLE]);
+    for (int l = n - 1; idx >= 0 && l >= 0 && blocks == 0; l--)
+    {
+        int leaf = block_index(block_ptrs(idx)[l]);
+        for (int k = n - 1; leaf >= 0 && k >= 0 && blocks == 0; k--)
+            blocks = block_index(block_ptrs(leaf)[k]) >= 0 ? EXT_DIRECT_PTRS + n + (long long)l * n + k + 1 : 0;
+    }
+    idx = block_index(ino->direct[EXT_SINGLE]);
+    for (int k = n - 1; idx >= 0 && k >= 0 && blocks == 0; k--)
+        blocks = block_index(block_ptrs(idx)[k]) >= 0 ? EXT_DIRECT_PTRS + k + 1 : 0;
+    for (int j = EXT_DIRECT_PTRS; j > 0 && blocks == 0; j--)
+        blocks = block_index(ino->direct[j - 1]) >= 0 ? j : 0;
+    return blocks * block_size;
+}
+
+int size_past_blocks(inode_t *ino)
+{
+    long long slack = block_size == UFS_BLOCK_SIZE ? block_size - 1 : 0;
+    return ino->size < 0 || ino->size > mapped_extent(ino) + slack;
+}
+
+// pass 1: every allocated inode on its own, counting block references. A
+// file whose size runs past its data is kept; repair cuts the size back.
+void check_inodes(int from, int to)
+{
+    block_set_t seen = {NULL, NULL, 0, 0, 0};
+    for (int i = from; i < to; i++)
+    {
+        if (!get_bit(inode_bitmap, i))
+            continue;
+
+        inode_t *ino = &inodes[i];
+        if (ino->type == UFS_DIRECTORY)
+        {
+            if (block_index(ino->direct[0]) < 0 || ino->size < 2 * (int)sizeof(dir_ent_t) || ino->size > block_size)
+            {
+                problem(P_INODE, "inode %d: directory with block %d, size %d", i, (int)ino->direct[0], ino->size);
+                bad[i] = 1;
+                continue;
+            }
+        }
+        else if (ino->type != UFS_REGULAR_FILE)
+        {
+            problem(P_INODE, "inode %d: type %d, size %d", i, ino->type, ino->size);
+            bad[i] = 1;
+            continue;
+        }
+        else if (size_past_blocks(ino))
+            problem(P_SIZE, "inode %d: size %d, blocks end at %lld", i, ino->size, mapped_extent(ino));
+
+        block_set_reset(&seen, i);
+        for (int j = 0; j < DIRECT_PTRS; j++)
+        {
+            char where[16];
+            snprintf(where, sizeof(where), "direct[%d]", j);
+            int depth = !ext_format || j < EXT_DIRECT_PTRS ? 0 : j == EXT_SINGLE ? 1 : 2;
+            check_pointer(i, &ino->direct[j], depth, ino->type == UFS_DIRECTORY, where, &seen);
+        }
+    }
+    free(seen.block);
+    free(seen.stamp);
+}
+
+// pass 2: the tree from inode 0, breadth first. Only directory blocks are
+// read, so this is cheap next to the passes over every inode and block.
+// With `repair`, entries that cannot stand are dropped as they are found.
+void walk_tree(int repair)
+{
+    int *queue = malloc(sizeof(int) * sb->num_inodes);
+    int *parent = malloc(sizeof(int) * sb->num_inodes);
+    int head = 0, tail = 0;
+
+    queue[tail++] = 0;
+    parent[0] = 0;
+    reached[0] = 1;
+    while (head < tail)
+    {
+        int d = queue[head++];
+        dir_ent_t *e = dir_entries(d);
+        int used = 0;
+
+        for (int i = 0; i < entries_per_block; i++)
+        {
+            if (e[i].inum == -1)
+                continue;
+            int t = e[i].inum;
+            int dot = i == 0 && strcmp(e[i].name, ".") == 0;
+            int dotdot = i == 1 && strcmp(e[i].name, "..") == 0;
+            if (dot || dotdot)
+            {
+                int want = dot ? d : parent[d];
+                if (t != want)
+                {
+                    problem(P_DOT, "directory %d: %s is %d, not %d", d, e[i].name, t, want);
+                    if (repair)
+                        e[i].inum = want;
+                }
+                used++;
+                continue;
+            }
+
+            char *why = NULL;
+            if (t < 0 || t >= sb->num_inodes)
+                why = "out of range";
+            else if (!get_bit(inode_bitmap, t))
+                why = "free";
+            else if (bad[t])
+                why = "broken";
+            else if (t == 0 || (reached[t] && inodes[t].type == UFS_DIRECTORY))
+                why = "a directory reached before";
+            else if (inodes[t].type == UFS_DIRECTORY && meta_refs[block_index(inodes[t].direct[0])] > 1)
+                why = "a directory sharing its block";
+            if (why != NULL)
+            {
+                problem(t >= 0 && t < sb->num_inodes && reached[t] ? P_LINKED : P_ENTRY,
+                        "directory %d: entry %d \"%.28s\" names inode %d, %s", d, i, e[i].name, t, why);
+                if (repair)
+                {
+                    e[i].inum = -1;
+                    e[i].name[0] = '\0';
+                    continue;
+                }
+            }
+            else if (++links[t] > 1)
+            {
+                problem(P_LINKED, "directory %d: entry \"%.28s\" links inode %d again", d, e[i].name, t);
+                if (repair)
+                {
+                    links[t]--;
+                    e[i].inum = -1;
+                    e[i].name[0] = '\0';
+                    continue;
+                }
+            }
+            else
+            {
+                reached[t] = 1;
+                if (inodes[t].type == UFS_DIRECTORY)
+                {
+                    parent[t] = d;
+                    queue[tail++] = t;
+                }
+            }
+            used++;
+        }
+
+        if (inodes[d].size != used * (int)sizeof(dir_ent_t))
+        {
+            problem(P_DIRSIZE, "directory %d: size %d, %d entries", d, inodes[d].size, used);
+            if (repair)
+                inodes[d].size = used * sizeof(dir_ent_t);
+        }
+    }
+    free(queue);
+    free(parent);
+}
+
+// pass 3: bitmaps against what pass 1 and 2 found
+void check_inode_bitmap(int from, int to)
+{
+    for (int i = from; i < to; i++)
+    {
+        int marked = get_bit(inode_bitmap, i);
+        if (marked && !reached[i])
+            problem(P_ORPHAN, "inode %d: allocated, not reachable from the root", i);
+        else if (!marked && reached[i])
+            problem(P_IBITMAP, "inode %d: reachable, free in the bitmap", i);
+    }
+}
+
+void check_data_bitmap(int from, int to)
+{
+    for (int b = from; b < to; b++)
+    {
+        int marked = get_bit(data_bitmap, b);
+        if (marked && refs[b] == 0)
+            problem(P_LEAKED, "data block %d: allocated, not used", b);
+        else if (!marked && refs[b] > 0)
+            problem(P_UNMARKED, "data block %d: used by %u inodes, free in the bitmap", b, refs[b]);
+
+        if (refs[b] > 1 && meta_refs[b] > 0)
+            problem(P_DOUBLE, "data block %d: directory or indirect block with %u pointers to it", b, refs[b]);
+        else if (refs[b] > 1)
+            __atomic_fetch_add(&shared_blocks, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// keeps the pointer in `slot` of file `inum` if it is a block of its own, and
+// the pointers below it if it is an indirect block
+void repair_pointer(int inum, unsigned int *slot, int depth)
+{
+    if (*slot == -1)
+        return;
+    int idx = block_index(*slot);
+    if (idx < 0 || owner[idx] == inum + 1 || meta_refs[idx] > (depth > 0 ? 1 : 0))
+    {
+        *slot = -1;
+        return;
+    }
+
+    owner[idx] = inum + 1;
+    refs[idx]++;
+    if (depth > 0)
+    {
+        unsigned int *ptrs = block_ptrs(idx);
+        for (int k = 0; k < INDIRECT_PTRS(block_size); k++)
+            repair_pointer(inum, &ptrs[k], depth - 1);
+    }
+}
+
+// what the tree walk kept stays: unreachable inodes are freed, pointers that
+// are not blocks or that clash with a directory or indirect block are
+// cleared, file sizes are cut back to the end of the blocks left, and both
+// bitmaps are rebuilt from the result. Directories sharing a block were
+// already cut loose by the walk: there is no telling whose the entries are.
+void repair()
+{
+    memset(refs, 0, sizeof(unsigned int) * sb->num_data);
+    memset(owner, 0, sizeof(int) * sb->num_data);
+    for (int i = 0; i < sb->num_inodes; i++)
+    {
+        if (!reached[i] || inodes[i].type != UFS_DIRECTORY)
+            continue;
+        refs[block_index(inodes[i].direct[0])]++;
+    }
+
+    for (int i = 0; i < sb->num_inodes; i++)
+    {
+        inode_t *ino = &inodes[i];
+        if (!reached[i])
+        {
+            if (get_bit(inode_bitmap, i))
+            {
+                ino->type = 0;
+                ino->size = 0;
+                for (int j = 0; j < DIRECT_PTRS; j++)
+                    ino->direct[j] = -1;
+            }
+            set_bit(inode_bitmap, i, 0);
+            continue;
+        }
+
+        set_bit(inode_bitmap, i, 1);
+        if (ino->type == UFS_DIRECTORY)
+        {
+            for (int j = 1; j < DIRECT_PTRS; j++)
+                ino->direct[j] = -1; // directories are one block
+            continue;
+        }
+        for (int j = 0; j < DIRECT_PTRS; j++)
+            repair_pointer(i, &ino->direct[j], !ext_format || j < EXT_DIRECT_PTRS ? 0 : j == EXT_SINGLE ? 1 : 2);
+        if (size_past_blocks(ino))
+            ino->size = ino->size < 0 ? 0 : mapped_extent(ino);
+    }
+
+    for (int b = 0; b < sb->num_data; b++)
+        set_bit(data_bitmap, b, refs[b] > 0);
+}
+
+int main(int argc, char *argv[])
+{
+    int do_repair = 0;
+    int ch;
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((ch = getopt(argc, argv, "rj:v")) != -1)
+    {
+        switch (ch)
+        {
+        case 'r':
+            do_repair = 1;
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 1 || nthreads < 1)
+        usage();
+
+    int fd = open(argv[optind], do_repair ? O_RDWR : O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(argv[optind]);
+        exit(FSCK_FAILED);
+    }
+    if (st.st_size < UFS_BLOCK_SIZE)
+    {
+        fprintf(stderr, "mfsck: %s: not an image\n", argv[optind]);
+        exit(FSCK_FAILED);
+    }
+
+    // repairs go straight to the file; checking never writes
+    char *img = mmap(NULL, st.st_size, PROT_READ | (do_repair ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    if (img == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(FSCK_FAILED);
+    }
+    sb = (super_t *)img;
+    int features = sb->magic == UFS_MAGIC ? sb->features : 0;
+    if (features & ~(UFS_FEATURE_INDIRECT | UFS_FEATURE_BLOCK_SIZE))
+    {
+        fprintf(stderr, "mfsck: %s: made by a newer mkfs\n", argv[optind]);
+        exit(FSCK_FAILED);
+    }
+    ext_format = (features & UFS_FEATURE_INDIRECT) != 0;
+    block_size = features & UFS_FEATURE_BLOCK_SIZE ? sb->block_size : UFS_BLOCK_SIZE;
+    entries_per_block = block_size / sizeof(dir_ent_t);
+    if (block_size < UFS_BLOCK_SIZE || block_size > UFS_MAX_BLOCK_SIZE || (block_size & (block_size - 1)) ||
+        check_super(st.st_size) < 0)
+    {
+        fprintf(stderr, "mfsck: %s: bad superblock\n", argv[optind]);
+        exit(FSCK_FAILED);
+    }
+    inode_bitmap = (unsigned int *)(img + (size_t)sb->inode_bitmap_addr * block_size);
+    data_bitmap = (unsigned int *)(img + (size_t)sb->data_bitmap_addr * block_size);
+    inodes = (inode_t *)(img + (size_t)sb->inode_region_addr * block_size);
+    data_region = (dir_ent_t *)(img + (size_t)sb->data_region_addr * block_size);
+    madvise(inodes, (size_t)sb->num_inodes * sizeof(inode_t), MADV_SEQUENTIAL);
+
+    refs = calloc(sb->num_data, sizeof(unsigned int));
+    meta_refs = calloc(sb->num_data, sizeof(unsigned int));
+    owner = calloc(sb->num_data, sizeof(int));
+    bad = calloc(sb->num_inodes, 1);
+    reached = calloc(sb->num_inodes, 1);
+    links = calloc(sb->num_inodes, sizeof(int));
+
+    parallel_for(sb->num_inodes, check_inodes);
+    if (!get_bit(inode_bitmap, 0) || inodes[0].type != UFS_DIRECTORY || bad[0] || meta_refs[block_index(inodes[0].direct[0])] > 1)
+    {
+        fprintf(stderr, "mfsck: %s: root directory is broken, nothing to walk\n", argv[optind]);
+        exit(FSCK_ERRORS);
+    }
+    walk_tree(do_repair);
+    parallel_for(sb->num_inodes, check_inode_bitmap);
+    parallel_for(sb->num_data, check_data_bitmap);
+
+    unsigned long long total = 0;
+    for (int k = 0; k < P_KINDS; k++)
+    {
+        if (problems[k] > 0)
+            printf("%llu %s\n", problems[k], problem_names[k]);
+        total += problems[k];
+    }
+    printf("%s: %d inodes, %d data blocks, %llu shared by clones, %llu problems\n",
+           argv[optind], sb->num_inodes, sb->num_data, shared_blocks, total);
+    if (total == 0)
+        return FSCK_OK;
+    if (!do_repair)
+        return FSCK_ERRORS;
+
+    repair();
+    msync(img, st.st_size, MS_SYNC);
+    printf("%s: repaired\n", argv[optind]);
+    return FSCK_REPAIRED;
+}
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "udp.h"
+#include "mfs.h"
+#include "msg.h"
+#include "stats.h"
+
+#define MAX_SESSIONS 64     // client addresses relayed at once
+#define MAX_PENDING 4096    // datagrams held back by delay or reordering
+#define MAX_DGRAM (sizeof(MSG_t))
+#define MAX_RATES 32
+#define BENCH_FILE "mfsproxy.bench"
+
+// fault model, applied to each datagram in both directions
+double drop_pct = 0;
+double burst_len = 1;   // mean length of a run of drops; 1 = independent
+double dup_pct = 0;
+int delay_us = 0;
+int jitter_us = 0;      // extra delay, uniform in [0, jitter]
+double reorder_pct = 0;
+int reorder_us = 5000;  // how long a reordered datagram is held back
+unsigned long long rng = 88172645463325252ULL;
+
+// a client of the proxy, and the socket its requests go out on, so that
+// replies can be told apart
+typedef struct
+{
+    struct sockaddr_in client;
+    int fd;
+    long long last_us; // last request relayed
+} session_t;
+
+// a datagram to be sent at due_us
+typedef struct
+{
+    long long due_us;
+    int fd;
+    struct sockaddr_in to;
+    int len;
+    char *data;
+} pending_t;
+
+int listen_fd;
+struct sockaddr_in server_addr;
+session_t sessions[MAX_SESSIONS];
+int num_sessions = 0;
+pending_t pending[MAX_PENDING];
+int num_pending = 0;
+int in_burst = 0;
+int proxy_stop = 0;
+pthread_t proxy_tid;
+
+struct
+{
+    unsigned long long packets;
+    unsigned long long dropped;
+    unsigned long long duplicated;
+    unsigned long long reordered;
+    unsigned long long overflow; // no room left to hold a datagram back
+} proxy_stats;
+
+void usage()
+{
+    fprintf(stderr, "usage: mfsproxy [-d drop%%] [-g burst_len] [-u dup%%] [-l delay_ms] [-j jitter_ms]\n"
+                    "                [-r reorder%%] [-R reorder_ms] [-s seed] listen_port server_host server_port\n"
+                    "       mfsproxy -B loss%%,... [-n ops] [fault options] server_host server_port\n");
+    exit(1);
+}
+
+long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// xorshift64*: reproducible runs for a given -s
+double uniform()
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (double)((rng * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+int chance(double pct)
+{
+    return pct > 0 && uniform() * 100 < pct;
+}
+
+// Gilbert model: drops come in runs of burst_len on average, at drop_pct
+// overall. burst_len 1 is plain independent loss.
+int lose()
+{
+    if (drop_pct <= 0)
+        return 0;
+    if (burst_len <= 1)
+        return chance(drop_pct);
+
+    double leave = 1 / burst_len;
+    double enter = drop_pct / 100 * leave / (1 - drop_pct / 100);
+    if (in_burst)
+        in_burst = uniform() >= leave;
+    else
+        in_burst = uniform() < enter;
+    return in_burst;
+}
+
+void hold(int fd, struct sockaddr_in *to, char *buf, int len, long long due_us)
+{
+    if (num_pending == MAX_PENDING)
+    {
+        proxy_stats.overflow++;
+        UDP_Write(fd, to, buf, len);
+        return;
+    }
+
+    pending_t *p = &pending[num_pending++];
+    p->due_us = due_us;
+    p->fd = fd;
+    p->to = *to;
+    p->len = len;
+    p->data = malloc(len);
+    memcpy(p->data, buf, len);
+}
+
+// sends, drops, duplicates or holds back one datagram
+void inject(int fd, struct sockaddr_in *to, char *buf, int len)
+{
+    proxy_stats.packets++;
+    if (lose())
+    {
+        proxy_stats.dropped++;
+        return;
+    }
+
+    int copies = 1;
+    if (chance(dup_pct))
+    {
+        proxy_stats.duplicated++;
+        copies = 2;
+    }
+
+    for (int i = 0; i < copies; i++)
+    {
+        long long delay = delay_us + (jitter_us > 0 ? (long long)(uniform() * jitter_us) : 0);
+        if (chance(reorder_pct))
+        {
+            proxy_stats.reordered++;
+            delay += reorder_us; // later datagrams overtake it
+        }
+
+        if (delay == 0)
+            UDP_Write(fd, to, buf, len);
+        else
+            hold(fd, to, buf, len, now_us() + delay);
+    }
+}
+
+// sends what is due; returns the ms until the next datagram is, or -1
+int flush_pending()
+{
+    long long now = now_us();
+    long long next = -1;
+
+    for (int i = 0; i < num_pending;)
+    {
+        pending_t *p = &pending[i];
+        if (p->due_us <= now)
+        {
+            UDP_Write(p->fd, &p->to, p->data, p->len);
+            free(p->data);
+            *p = pending[--num_pending];
+            continue;
+        }
+        if (next < 0 || p->due_us < next)
+            next = p->due_us;
+        i++;
+    }
+    return next < 0 ? -1 : (int)((next - now + 999) / 1000);
+}
+
+session_t *find_session(struct sockaddr_in *client)
+{
+    long long now = now_us();
+    session_t *lru = &sessions[0];
+    for (int i = 0; i < num_sessions; i++)
+    {
+        if (sessions[i].client.sin_addr.s_addr == client->sin_addr.s_addr &&
+            sessions[i].client.sin_port == client->sin_port)
+        {
+            sessions[i].last_us = now;
+            return &sessions[i];
+        }
+        if (sessions[i].last_us < lru->last_us)
+            lru = &sessions[i];
+    }
+
+    // the least recently used session makes way once the table is full
+    session_t *s = num_sessions < MAX_SESSIONS ? &sessions[num_sessions++] : lru;
+    if (s->fd > 0)
+        UDP_Close(s->fd);
+    s->client = *client;
+    s->fd = UDP_Open(0);
+    s->last_us = now;
+    return s;
+}
+
+void *proxy_loop(void *arg)
+{
+    char buf[MAX_DGRAM];
+    struct pollfd fds[MAX_SESSIONS + 1];
+    struct sockaddr_in from;
+
+    while (!__atomic_load_n(&proxy_stop, __ATOMIC_ACQUIRE))
+    {
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < num_sessions; i++)
+        {
+            fds[i + 1].fd = sessions[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        int timeout = flush_pending();
+        if (timeout < 0 || timeout > 50)
+            timeout = 50; // to notice proxy_stop
+        int nfds = num_sessions + 1;
+        if (poll(fds, nfds, timeout) <= 0)
+            continue;
+
+        // client -> server
+        if (fds[0].revents & POLLIN)
+        {
+            int len = UDP_Read(listen_fd, &from, buf, sizeof(buf));
+            if (len > 0)
+                inject(find_session(&from)->fd, &server_addr, buf, len);
+        }
+
+        // server -> client
+        for (int i = 1; i < nfds; i++)
+        {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            int len = UDP_Read(fds[i].fd, &from, buf, sizeof(buf));
+            if (len > 0)
+                inject(listen_fd, &sessions[i - 1].client, buf, len);
+        }
+    }
+    return NULL;
+}
+
+// The benchmark runs the proxy thread only while it relays, and changes the
+// fault model and reads the counters while the thread is stopped.
+void proxy_start(double rate)
+{
+    drop_pct = rate;
+    in_burst = 0;
+    __atomic_store_n(&proxy_stop, 0, __ATOMIC_RELEASE);
+    pthread_create(&proxy_tid, NULL, proxy_loop, NULL);
+}
+
+// stops the thread; datagrams still held back are dropped with it
+void proxy_halt()
+{
+    __atomic_store_n(&proxy_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(proxy_tid, NULL);
+    for (int i = 0; i < num_pending; i++)
+        free(pending[i].data);
+    num_pending = 0;
+}
+
+int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(long long *)a, y = *(long long *)b;
+    return (x > y) - (x < y);
+}
+
+// `ops` WRITE + READ pairs of one block through the proxy at `rate`, each
+// read checked against what was written. Setup and the server's counters go
+// through a lossless proxy.
+void bench_rate(int proxy_port, double rate, int ops)
+{
+    proxy_start(0);
+    if (MFS_Init("localhost", proxy_port) < 0)
+    {
+        fprintf(stderr, "mfsproxy: no server behind the proxy\n");
+        exit(1);
+    }
+
+    int inum = MFS_Lookup(0, BENCH_FILE);
+    if (inum < 0 && MFS_Creat(0, MFS_REGULAR_FILE, BENCH_FILE) == 0)
+        inum = MFS_Lookup(0, BENCH_FILE);
+    if (inum < 0)
+    {
+        fprintf(stderr, "mfsproxy: cannot create /%s\n", BENCH_FILE);
+        exit(1);
+    }
+
+    MFS_Stats_t before, after;
+    MFS_Stats(&before);
+    proxy_halt();
+
+    memset(&proxy_stats, 0, sizeof(proxy_stats));
+    proxy_start(rate);
+
+    char wbuf[MFS_BLOCK_SIZE], rbuf[MFS_BLOCK_SIZE];
+    long long *lat = malloc(sizeof(long long) * 2 * ops);
+    int errors = 0;
+    long long start = now_us();
+    for (int i = 0; i < ops; i++)
+    {
+        memset(wbuf, 'a' + i % 26, sizeof(wbuf));
+        int block = i % 30;
+
+        long long t = now_us();
+        errors += MFS_Write(inum, wbuf, block * MFS_BLOCK_SIZE, MFS_BLOCK_SIZE) < 0;
+        lat[2 * i] = now_us() - t;
+
+        t = now_us();
+        errors += MFS_Read(inum, rbuf, block * MFS_BLOCK_SIZE, MFS_BLOCK_SIZE) < 0 ||
+                  memcmp(wbuf, rbuf, sizeof(rbuf)) != 0;
+        lat[2 * i + 1] = now_us() - t;
+    }
+    double secs = (now_us() - start) / 1e6;
+    proxy_halt();
+
+    unsigned long long dropped = proxy_stats.dropped;
+    proxy_start(0);
+    MFS_Stats(&after);
+    proxy_halt();
+
+    qsort(lat, 2 * ops, sizeof(long long), cmp_ll);
+    printf("%6.1f %10.1f %9lld %9lld %9lld %9llu %9llu %9llu %7d\n",
+           rate, 2.0 * ops * MFS_BLOCK_SIZE / secs / 1024, lat[ops], lat[(int)(2 * ops * 0.99)],
+           lat[2 * ops - 1], dropped, after.retransmits - before.retransmits,
+           after.duplicates - before.duplicates, errors);
+    fflush(stdout);
+    free(lat);
+}
+
+int main(int argc, char *argv[])
+{
+    double rates[MAX_RATES];
+    int num_rates = 0;
+    int ops = 500;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "d:g:u:l:j:r:R:s:B:n:")) != -1)
+    {
+        switch (ch)
+        {
+        case 'd':
+            drop_pct = atof(optarg);
+            break;
+        case 'g':
+            burst_len = atof(optarg);
+            break;
+        case 'u':
+            dup_pct = atof(optarg);
+            break;
+        case 'l':
+            delay_us = atof(optarg) * 1000;
+            break;
+        case 'j':
+            jitter_us = atof(optarg) * 1000;
+            break;
+        case 'r':
+            reorder_pct = atof(optarg);
+            break;
+        case 'R':
+            reorder_us = atof(optarg) * 1000;
+            break;
+        case 's':
+            rng = strtoull(optarg, NULL, 0) | 1;
+            break;
+        case 'B':
+            for (char *p = strtok(optarg, ","); p != NULL && num_rates < MAX_RATES; p = strtok(NULL, ","))
+                rates[num_rates++] = atof(p);
+            break;
+        case 'n':
+            ops = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (drop_pct < 0 || drop_pct >= 100 || burst_len < 1 || ops < 1)
+        usage();
+    for (int i = 0; i < num_rates; i++)
+    {
+        if (rates[i] < 0 || rates[i] >= 100)
+            usage();
+    }
+
+    int bench = num_rates > 0;
+    if (argc - optind != (bench ? 2 : 3))
+        usage();
+    char *host = argv[argc - 2];
+    if (UDP_FillSockAddr(&server_addr, host, atoi(argv[argc - 1])) < 0)
+    {
+        fprintf(stderr, "mfsproxy: unknown host %s\n", host);
+        exit(1);
+    }
+
+    if (!bench)
+    {
+        listen_fd = UDP_Open(atoi(argv[optind]));
+        assert(listen_fd > -1);
+        proxy_loop(NULL);
+        return 0;
+    }
+
+    // benchmark: the proxy runs in a thread on a free port, and libmfs talks
+    // to it over UDP (shared memory would go around it)
+    setenv("MFS_NO_SHM", "1", 1);
+    listen_fd = UDP_Open(0);
+    assert(listen_fd > -1);
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    getsockname(listen_fd, (struct sockaddr *)&local, &len);
+
+    printf("%6s %10s %9s %9s %9s %9s %9s %9s %7s\n", "loss%", "KB/s", "p50(us)", "p99(us)", "max(us)",
+           "dropped", "resent", "dups", "errors");
+    for (int i = 0; i < num_rates; i++)
+        bench_rate(ntohs(local.sin_port), rates[i], ops);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mfs.h"
+#include "msg.h"
+#include "stats.h"
+#include "trace.h"
+
+char *op_names[STATS_OPS] = {
+    [INIT_t] = "init",
+    [LOOKUP_t] = "lookup",
+    [STAT_t] = "stat",
+    [WRITE_t] = "write",
+    [READ_t] = "read",
+    [CREAT_t] = "creat",
+    [UNLINK_t] = "unlink",
+    [SHUTDOWN_t] = "shutdown",
+    [STATS_t] = "stats",
+    [TRACE_t] = "trace",
+    [REPL_HELLO_t] = "repl_hello",
+    [SHM_ATTACH_t] = "shm_attach",
+    [COPY_t] = "copy",
+    [CLONE_t] = "clone",
+    [WATCH_t] = "watch",
+};
+
+void usage()
+{
+    fprintf(stderr, "usage: mfsstat [-i interval_sec] [-c count] [-l trace_level] [-d] hostname port\n");
+    exit(1);
+}
+
+// upper bound (us) of the bucket holding the q-th quantile of `hist`
+unsigned long long percentile(unsigned int *hist, unsigned long long total, double q)
+{
+    unsigned long long seen = 0;
+    for (int b = 0; b < STATS_HIST_BUCKETS; b++)
+    {
+        seen += hist[b];
+        if (seen > 0 && seen >= q * total)
+            return b + 1 < STATS_HIST_BUCKETS ? stats_bucket_low(b + 1) : stats_bucket_low(b);
+    }
+    return 0;
+}
+
+void print_stats(MFS_Stats_t *cur, MFS_Stats_t *prev)
+{
+    double secs = (cur->uptime_us - prev->uptime_us) / 1e6;
+    if (secs <= 0)
+        secs = 1;
+
+    printf("uptime %.1fs  in %llu B (%.0f B/s)  out %llu B (%.0f B/s)\n",
+           cur->uptime_us / 1e6, cur->bytes_in, (cur->bytes_in - prev->bytes_in) / secs,
+           cur->bytes_out, (cur->bytes_out - prev->bytes_out) / secs);
+    printf("duplicates %llu  retransmits %llu  bad %llu  free inodes %d/%d  free data %d/%d (%d B blocks)  watches %d\n",
+           cur->duplicates, cur->retransmits, cur->bad_requests,
+           cur->free_inodes, cur->num_inodes, cur->free_data, cur->num_data, cur->block_size, cur->watches);
+    printf("queued %d  busy %llu (%.1f/s)\n", cur->queued, cur->busy, (cur->busy - prev->busy) / secs);
+    if (cur->repl_backups > 0 || cur->repl_forwarded > 0 || cur->repl_rejected_hellos > 0)
+        printf("backups %d  forwarded %llu  rejected hellos %llu\n",
+               cur->repl_backups, cur->repl_forwarded, cur->repl_rejected_hellos);
+    if (cur->checkpoints > 0 || cur->checkpoint_failures > 0)
+        printf("checkpoints %llu (failed %llu)  last %u ms, paused %u us (max %u us)  dirty %llu B\n",
+               cur->checkpoints, cur->checkpoint_failures, cur->checkpoint_ms, cur->checkpoint_pause_us,
+               cur->checkpoint_max_pause_us, cur->dirty_bytes);
+    if (cur->payload_raw > 0)
+        printf("payload %llu B as %llu B on the wire (%.1f%%)  compressed %llu  skipped %llu\n",
+               cur->payload_raw, cur->payload_wire, 100.0 * cur->payload_wire / cur->payload_raw,
+               cur->compressed, cur->compress_skipped);
+    printf("%-9s %10s %9s %8s %8s %8s %8s\n", "op", "count", "ops/s", "errors", "p50(us)", "p90(us)", "p99(us)");
+
+    for (int op = 1; op < STATS_OPS; op++)
+    {
+        if (op_names[op] == NULL || cur->ops[op] == 0)
+            continue;
+
+        // percentiles over this interval only
+        unsigned int hist[STATS_HIST_BUCKETS];
+        unsigned long long total = 0;
+        for (int b = 0; b < STATS_HIST_BUCKETS; b++)
+        {
+            hist[b] = cur->latency[op][b] - prev->latency[op][b];
+            total += hist[b];
+        }
+
+        printf("%-9s %10llu %9.1f %8llu %8llu %8llu %8llu\n", op_names[op], cur->ops[op],
+               (cur->ops[op] - prev->ops[op]) / secs, cur->errors[op],
+               percentile(hist, total, 0.5), percentile(hist, total, 0.9), percentile(hist, total, 0.99));
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    int interval = 1;
+    int count = -1;
+    int trace_level = -1;
+    int trace_dump = 0;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "i:c:l:d")) != -1)
+    {
+        switch (ch)
+        {
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'c':
+            count = atoi(optarg);
+            break;
+        case 'l':
+            trace_level = atoi(optarg);
+            break;
+        case 'd':
+            trace_dump = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 2)
+        usage();
+
+    if (MFS_Init(argv[optind], atoi(argv[optind + 1])) < 0)
+    {
+        fprintf(stderr, "mfsstat: cannot reach %s:%s\n", argv[optind], argv[optind + 1]);
+        exit(1);
+    }
+
+    // trace control is a one-shot request
+    if (trace_level >= 0 || trace_dump)
+    {
+        if (MFS_Trace(trace_level, trace_dump) < 0)
+        {
+            fprintf(stderr, "mfsstat: trace request failed\n");
+            exit(1);
+        }
+        return 0;
+    }
+
+    MFS_Stats_t prev, cur;
+    memset(&prev, 0, sizeof(prev));
+    for (int i = 0; count < 0 || i < count; i++)
+    {
+        if (i > 0)
+            sleep(interval);
+
+        if (MFS_Stats(&cur) < 0)
+        {
+            fprintf(stderr, "mfsstat: no reply from server\n");
+            continue;
+        }
+        print_stats(&cur, &prev);
+        prev = cur;
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "msg.h"
+#include "trace.h"
+
+char *op_names[] = {
+    [INIT_t] = "init",
+    [LOOKUP_t] = "lookup",
+    [STAT_t] = "stat",
+    [WRITE_t] = "write",
+    [READ_t] = "read",
+    [CREAT_t] = "creat",
+    [UNLINK_t] = "unlink",
+    [SHUTDOWN_t] = "shutdown",
+    [STATS_t] = "stats",
+    [TRACE_t] = "trace",
+    [REPL_HELLO_t] = "repl_hello",
+    [SHM_ATTACH_t] = "shm_attach",
+    [COPY_t] = "copy",
+    [CLONE_t] = "clone",
+    [WATCH_t] = "watch",
+};
+
+char *event_names[] = {
+    [TRACE_REQUEST] = "request",
+    [TRACE_DUP] = "dup",
+    [TRACE_SAVE] = "save",
+    [TRACE_LEVEL] = "level",
+    [TRACE_BUSY] = "busy",
+    [TRACE_CHECKPOINT] = "checkpoint",
+};
+
+void usage()
+{
+    fprintf(stderr, "usage: mfstrace [-r] trace_file\n");
+    exit(1);
+}
+
+int cmp_rec(const void *a, const void *b)
+{
+    const trace_rec_t *x = a, *y = b;
+    return (x->ts_ns > y->ts_ns) - (x->ts_ns < y->ts_ns);
+}
+
+char *name_of(char **names, int n, int i)
+{
+    return i >= 0 && i < n && names[i] != NULL ? names[i] : "?";
+}
+
+int main(int argc, char *argv[])
+{
+    int relative = 0; // print times relative to the first record
+    int ch;
+
+    while ((ch = getopt(argc, argv, "r")) != -1)
+    {
+        switch (ch)
+        {
+        case 'r':
+            relative = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 1)
+        usage();
+
+    FILE *f = fopen(argv[optind], "r");
+    if (f == NULL)
+    {
+        perror("fopen");
+        exit(1);
+    }
+
+    trace_file_hdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, TRACE_MAGIC, 8) != 0 || hdr.version != 1)
+    {
+        fprintf(stderr, "mfstrace: %s is not a trace dump\n", argv[optind]);
+        exit(1);
+    }
+
+    // merge every ring into one timeline
+    trace_rec_t *recs = NULL;
+    int nrecs = 0;
+    for (int r = 0; r < hdr.nrings; r++)
+    {
+        trace_ring_hdr_t ring_hdr;
+        if (fread(&ring_hdr, sizeof(ring_hdr), 1, f) != 1)
+            break;
+        if (ring_hdr.dropped > 0)
+            printf("# thread %d: %llu older records were overwritten\n", ring_hdr.tid, ring_hdr.dropped);
+
+        recs = realloc(recs, (nrecs + ring_hdr.nrecs) * sizeof(trace_rec_t));
+        nrecs += fread(&recs[nrecs], sizeof(trace_rec_t), ring_hdr.nrecs, f);
+    }
+    fclose(f);
+    qsort(recs, nrecs, sizeof(trace_rec_t), cmp_rec);
+
+    int nops = sizeof(op_names) / sizeof(op_names[0]);
+    int nevents = sizeof(event_names) / sizeof(event_names[0]);
+    printf("%-20s %7s %-8s %-9s %8s %5s %8s %10s\n", "time", "tid", "event", "op", "inum", "rc", "arg", "dur(us)");
+    for (int i = 0; i < nrecs; i++)
+    {
+        trace_rec_t *rec = &recs[i];
+        long long ts = relative ? (long long)(rec->ts_ns - recs[0].ts_ns)
+                                : (long long)rec->ts_ns + hdr.realtime_offset_ns;
+
+        printf("%10lld.%09lld %7d %-8s %-9s %8d %5d %8d %10.1f\n", ts / 1000000000LL, ts % 1000000000LL,
+               rec->tid, name_of(event_names, nevents, rec->event), name_of(op_names, nops, rec->op),
+               rec->inum, rec->rc, rec->arg, rec->dur_ns / 1000.0);
+    }
+
+    free(recs);
+    return 0;
+}
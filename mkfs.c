@@ -8,7 +8,7 @@
 #include "ufs.h"
 
 void usage() {
-    fprintf(stderr, "usage: mkfs -f <image_file> [-d <num_data_blocks] [-i <num_inodes>]\n");
+    fprintf(stderr, "usage: mkfs -f <image_file> [-d <num_data_blocks] [-i <num_inodes>] [-x] [-b <block_size>]\n");
     exit(1);
 }
 
@@ -18,8 +18,10 @@ int main(int argc, char *argv[]) {
     int num_inodes = 32;
     int num_data = 32;
     int visual = 0;
+    int extended = 0;
+    int block_size = UFS_BLOCK_SIZE;
 
-    while ((ch = getopt(argc, argv, "i:d:f:v")) != -1) {
+    while ((ch = getopt(argc, argv, "i:d:f:vxb:")) != -1) {
 	switch (ch) {
 	case 'i':
 	    num_inodes = atoi(optarg);
@@ -33,6 +35,14 @@ int main(int argc, char *argv[]) {
 	case 'v':
 	    visual = 1;
 	    break;
+	case 'x':
+	    extended = 1;
+	    break;
+	case 'b':
+	    block_size = atoi(optarg);
+	    if (strchr(optarg, 'k') || strchr(optarg, 'K'))
+		block_size *= 1024;
+	    break;
 	default:
 	    usage();
 	}
@@ -42,9 +52,14 @@ int main(int argc, char *argv[]) {
 
     if (image_file == NULL)
 	usage();
+    // whole directory blocks of entries, and bitmaps of whole words
+    if (block_size < UFS_BLOCK_SIZE || block_size > UFS_MAX_BLOCK_SIZE || (block_size & (block_size - 1)) != 0) {
+	fprintf(stderr, "mkfs: block size must be a power of two from %d to %d\n", UFS_BLOCK_SIZE, UFS_MAX_BLOCK_SIZE);
+	exit(1);
+    }
 
     unsigned char *empty_buffer;
-    empty_buffer = calloc(UFS_BLOCK_SIZE, 1);
+    empty_buffer = calloc(block_size, 1);
     if (empty_buffer == NULL) {
 	perror("calloc");
 	exit(1);
@@ -66,8 +81,15 @@ int main(int argc, char *argv[]) {
     s.num_inodes = num_inodes;
     s.num_data = num_data;
 
+    // extended format: indirect blocks and/or another block size; classic
+    // images leave these zero
+    s.features = (extended ? UFS_FEATURE_INDIRECT : 0) | (block_size != UFS_BLOCK_SIZE ? UFS_FEATURE_BLOCK_SIZE : 0);
+    s.magic = s.features ? UFS_MAGIC : 0;
+    s.version = s.features ? 1 : 0;
+    s.block_size = s.features & UFS_FEATURE_BLOCK_SIZE ? block_size : 0;
+
     // inode bitmap
-    int bits_per_block = (8 * UFS_BLOCK_SIZE); // remember, there are 8 bits per byte
+    int bits_per_block = (8 * block_size); // remember, there are 8 bits per byte
 
     s.inode_bitmap_addr = 1;
     s.inode_bitmap_len = num_inodes / bits_per_block;
@@ -83,8 +105,8 @@ int main(int argc, char *argv[]) {
     // inode table
     s.inode_region_addr = s.data_bitmap_addr + s.data_bitmap_len;
     int total_inode_bytes = num_inodes * sizeof(inode_t);
-    s.inode_region_len = total_inode_bytes / UFS_BLOCK_SIZE;
-    if (total_inode_bytes % UFS_BLOCK_SIZE != 0)
+    s.inode_region_len = total_inode_bytes / block_size;
+    if (total_inode_bytes % block_size != 0)
 	s.inode_region_len++;
 
     // data blocks
@@ -103,6 +125,8 @@ int main(int argc, char *argv[]) {
     printf("total blocks        %d\n", total_blocks);
     printf("  inodes            %d [size of each: %lu]\n", num_inodes, sizeof(inode_t));
     printf("  data blocks       %d\n", num_data);
+    printf("  block size        %d\n", block_size);
+    printf("  format            %s\n", extended ? "extended (indirect blocks)" : "classic");
     printf("layout details\n");
     printf("  inode bitmap address/len %d [%d]\n", s.inode_bitmap_addr, s.inode_bitmap_len);
     printf("  data bitmap address/len  %d [%d]\n", s.data_bitmap_addr, s.data_bitmap_len);
@@ -110,8 +134,8 @@ int main(int argc, char *argv[]) {
     // first, zero out all the blocks
     int i;
     for (i = 1; i < total_blocks; i++) {
-	rc = pwrite(fd, empty_buffer, UFS_BLOCK_SIZE, i * UFS_BLOCK_SIZE);
-	if (rc != UFS_BLOCK_SIZE) {
+	rc = pwrite(fd, empty_buffer, block_size, (off_t)i * block_size);
+	if (rc != block_size) {
 	    perror("write");
 	    exit(1);
 	}
@@ -120,65 +144,52 @@ int main(int argc, char *argv[]) {
     //
     // need to allocate first inode in inode bitmap
     //
-    typedef struct {
-	unsigned int bits[UFS_BLOCK_SIZE / sizeof(unsigned int)];
-    } bitmap_t;
-    assert(sizeof(bitmap_t) == UFS_BLOCK_SIZE);
-
-    bitmap_t b;
-    for (i = 0; i < 1024; i++)
-	b.bits[i] = 0;
-    b.bits[0] = 0x1 << 31; // first entry is allocated
+    unsigned int *bits = calloc(block_size, 1);
+    assert(bits != NULL);
+    bits[0] = 0x1 << 31; // first entry is allocated
     
-    rc = pwrite(fd, &b, UFS_BLOCK_SIZE, s.inode_bitmap_addr * UFS_BLOCK_SIZE);
-    assert(rc == UFS_BLOCK_SIZE);
+    rc = pwrite(fd, bits, block_size, (off_t)s.inode_bitmap_addr * block_size);
+    assert(rc == block_size);
 
     //
     // need to allocate first data block in data bitmap
     // (can just reuse this to write out data bitmap too)
     //
-    rc = pwrite(fd, &b, UFS_BLOCK_SIZE, s.data_bitmap_addr * UFS_BLOCK_SIZE);
-    assert(rc == UFS_BLOCK_SIZE);
+    rc = pwrite(fd, bits, block_size, (off_t)s.data_bitmap_addr * block_size);
+    assert(rc == block_size);
 
     //
     // need to write out inode
     //
-    typedef struct {
-	inode_t inodes[UFS_BLOCK_SIZE / sizeof(inode_t)];
-    } inode_block;
-
-    inode_block itable;
-    itable.inodes[0].type = UFS_DIRECTORY;
-    itable.inodes[0].size = 2 * sizeof(dir_ent_t); // in bytes
-    itable.inodes[0].direct[0] = s.data_region_addr;
+    inode_t *itable = calloc(block_size, 1);
+    assert(itable != NULL);
+    itable[0].type = UFS_DIRECTORY;
+    itable[0].size = 2 * sizeof(dir_ent_t); // in bytes
+    itable[0].direct[0] = s.data_region_addr;
     for (i = 1; i < DIRECT_PTRS; i++)
-	itable.inodes[0].direct[i] = -1;
+	itable[0].direct[i] = -1;
 
-    rc = pwrite(fd, &itable, UFS_BLOCK_SIZE, s.inode_region_addr * UFS_BLOCK_SIZE);
-    assert(rc == UFS_BLOCK_SIZE);
+    rc = pwrite(fd, itable, block_size, (off_t)s.inode_region_addr * block_size);
+    assert(rc == block_size);
 
     // 
     // need to write out root directory contents to first data block
     // create a root directory, with nothing in it
     // 
-    typedef struct {
-	dir_ent_t entries[128];
-    } dir_block_t;
-    // xxx assumes 4096 block, 32 byte entries
-    assert(sizeof(dir_ent_t) * 128 == UFS_BLOCK_SIZE);
-
-    dir_block_t parent;
-    strcpy(parent.entries[0].name, ".");
-    parent.entries[0].inum = 0;
+    int entries_per_block = block_size / sizeof(dir_ent_t);
+    dir_ent_t *parent = calloc(entries_per_block, sizeof(dir_ent_t));
+    assert(parent != NULL);
+    strcpy(parent[0].name, ".");
+    parent[0].inum = 0;
 
-    strcpy(parent.entries[1].name, "..");
-    parent.entries[1].inum = 0;
+    strcpy(parent[1].name, "..");
+    parent[1].inum = 0;
 
-    for (i = 2; i < 128; i++)
-	parent.entries[i].inum = -1;
+    for (i = 2; i < entries_per_block; i++)
+	parent[i].inum = -1;
 
-    rc = pwrite(fd, &parent, UFS_BLOCK_SIZE, s.data_region_addr * UFS_BLOCK_SIZE);
-    assert(rc == UFS_BLOCK_SIZE);
+    rc = pwrite(fd, parent, block_size, (off_t)s.data_region_addr * block_size);
+    assert(rc == block_size);
 
     if (visual) {
 	int i;
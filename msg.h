@@ -1,7 +1,9 @@
 #ifndef __MSG_h__
 #define __MSG_h__
 
-#define INIT_t 1
+#include <stddef.h>
+
+#define INIT_t 1 // reply nbytes: largest file, offset: block size
 #define LOOKUP_t 2
 #define STAT_t 3
 #define WRITE_t 4
@@ -9,6 +11,18 @@
 #define CREAT_t 6
 #define UNLINK_t 7
 #define SHUTDOWN_t 8
+#define STATS_t 9
+#define TRACE_t 10 // type: new trace level (-1 keeps it), nbytes: dump if non-zero
+#define REPL_HELLO_t 11 // primary to backup: a new replication sequence starts
+#define SHM_ATTACH_t 12 // inum: client pid, offset: ring memfd, nbytes: ring token, name: client hostname
+#define COPY_t 13 // inum: source, type: destination inum, offset and nbytes: byte range
+#define CLONE_t 14 // as COPY_t, sharing whole blocks copy-on-write
+#define WATCH_t 15 // inum: directory, offset: client's event port, nbytes: ttl in ms (-1 removes)
+#define WATCH_EVENT_t 16 // server to client, a watch_event_t rather than an MSG_t
+
+#define MSG_MAX_PAYLOAD (65536) // a whole block of the largest size mkfs makes
+#define MSG_UDP_MAX (65507)     // largest UDP payload over IPv4
+#define MSG_UDP_IO_MAX (32768)  // READ/WRITE bytes per datagram; 64K blocks take two
 
 typedef struct __MSG_t{
     int msg_type; // message type
@@ -19,9 +33,81 @@ typedef struct __MSG_t{
     int type;
     int offset;
 
+    int seq;     // per-client request number, echoed in the reply
+    int attempt; // 0 for the first send, incremented on every retransmission
+    int flags;   // MSG_* bits below
+    int zbytes;  // payload bytes in buffer when MSG_COMPRESSED
+
     char name[28]; // file or dir name
-    char buffer[4096]; // data
+    char buffer[MSG_MAX_PAYLOAD]; // data
 
 } MSG_t;
 
-#endif
\ No newline at end of file
+// a change in a watched directory, sent to the port named in WATCH_t
+typedef struct __watch_event_t {
+    int msg_type; // WATCH_EVENT_t
+    int seq;      // per registration, from 1; a gap means lost events
+    int pinum;
+    int event;    // MFS_WATCH_CREATED or MFS_WATCH_REMOVED
+    int inum;
+    char name[28];
+} watch_event_t;
+
+// flags
+#define MSG_REPLICATED (0x1)  // forwarded by the primary; seq is the replication sequence
+#define MSG_NOT_PRIMARY (0x2) // reply: mutation sent to a backup
+#define MSG_REPL_GAP (0x4)    // reply: backup missed earlier replicated ops
+#define MSG_COMPRESSED (0x8)  // buffer holds zbytes of lz.h-compressed payload
+#define MSG_COMPRESS_OK (0x10) // request: compressed replies are welcome; reply: so are requests
+#define MSG_BUSY (0x20)        // reply: not served, resend after `offset` ms
+
+// may be served by any replica
+static inline int msg_is_read_only(int msg_type)
+{
+    return msg_type == LOOKUP_t || msg_type == STAT_t || msg_type == READ_t;
+}
+
+static inline int msg_is_mutation(int msg_type)
+{
+    return msg_type == WRITE_t || msg_type == CREAT_t || msg_type == UNLINK_t || msg_type == SHUTDOWN_t ||
+           msg_type == COPY_t || msg_type == CLONE_t;
+}
+
+// bytes of a message that carry information; the rest of `buffer` is never
+// sent
+#define MSG_HEADER_SIZE ((int)offsetof(MSG_t, buffer))
+
+static inline int msg_payload(int nbytes)
+{
+    if (nbytes < 0)
+        return 0;
+    return nbytes < (int)sizeof(((MSG_t *)0)->buffer) ? nbytes : (int)sizeof(((MSG_t *)0)->buffer);
+}
+
+static inline int msg_wire_payload(MSG_t *msg, int nbytes)
+{
+    return msg->flags & MSG_COMPRESSED ? msg_payload(msg->zbytes) : msg_payload(nbytes);
+}
+
+static inline int msg_request_size(MSG_t *request)
+{
+    return MSG_HEADER_SIZE + (request->msg_type == WRITE_t ? msg_wire_payload(request, request->nbytes) : 0);
+}
+
+static inline int msg_reply_size(MSG_t *request, MSG_t *response)
+{
+    if (request->msg_type == READ_t)
+        return MSG_HEADER_SIZE + msg_wire_payload(response, request->nbytes);
+    if (request->msg_type == STATS_t)
+        return MSG_HEADER_SIZE + msg_payload(response->nbytes);
+    return MSG_HEADER_SIZE;
+}
+
+// whether a request, and the reply to it, fit in one datagram each
+static inline int msg_fits_udp(MSG_t *request)
+{
+    return msg_request_size(request) <= MSG_UDP_MAX &&
+           (request->msg_type != READ_t || MSG_HEADER_SIZE + msg_payload(request->nbytes) <= MSG_UDP_MAX);
+}
+
+#endif
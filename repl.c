@@ -0,0 +1,277 @@
+#include <sys/select.h>
+#include <arpa/inet.h>
+
+#include "repl.h"
+#include "trace.h"
+
+typedef struct
+{
+    struct sockaddr_in addr;
+    char name[64];
+    int live;
+    int acked; // for the op being forwarded
+} backup_t;
+
+// primary state
+backup_t backups[REPL_MAX_BACKUPS];
+int num_backups = 0;
+int repl_sd = -1; // separate socket, so acks never mix with client requests
+int repl_seq = 0;
+unsigned long long repl_forwarded = 0;
+
+// backup state
+int repl_is_backup = 0;
+struct in_addr primary_hosts[REPL_MAX_PRIMARIES]; // -P; any host if none
+int num_primary_hosts = 0;
+struct sockaddr_in primary_addr;
+int primary_known = 0;
+int applied_seq = 0;
+int applied_rc = 0;
+unsigned long long repl_rejected_hellos = 0;
+
+int repl_add_backup(char *host_port)
+{
+    char host[64];
+    char *colon = strrchr(host_port, ':');
+    if (num_backups == REPL_MAX_BACKUPS || colon == NULL || colon - host_port >= sizeof(host))
+        return -1;
+
+    memcpy(host, host_port, colon - host_port);
+    host[colon - host_port] = '\0';
+
+    backup_t *b = &backups[num_backups];
+    if (UDP_FillSockAddr(&b->addr, host, atoi(colon + 1)) < 0)
+        return -1;
+    snprintf(b->name, sizeof(b->name), "%s", host_port);
+    b->live = 1;
+    num_backups++;
+    return 0;
+}
+
+int repl_live_backups()
+{
+    int live = 0;
+    for (int i = 0; i < num_backups; i++)
+        live += backups[i].live;
+    return live;
+}
+
+backup_t *find_backup(struct sockaddr_in *addr)
+{
+    for (int i = 0; i < num_backups; i++)
+    {
+        if (backups[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            backups[i].addr.sin_port == addr->sin_port)
+            return &backups[i];
+    }
+    return NULL;
+}
+
+// send `msg` to every live backup and wait until each one acks it or runs out
+// of attempts; backups that time out or report a gap are dropped
+void repl_send_all(MSG_t *msg)
+{
+    int pending = 0;
+    for (int i = 0; i < num_backups; i++)
+    {
+        backups[i].acked = !backups[i].live;
+        pending += backups[i].live;
+    }
+
+    for (msg->attempt = 0; pending > 0 && msg->attempt < REPL_RETRIES; msg->attempt++)
+    {
+        for (int i = 0; i < num_backups; i++)
+        {
+            if (!backups[i].acked)
+                UDP_Write(repl_sd, &backups[i].addr, (char *)msg, msg_request_size(msg));
+        }
+
+        struct timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = REPL_TIMEOUT_MS * 1000;
+        while (pending > 0)
+        {
+            fd_set read_fdset;
+            FD_ZERO(&read_fdset);
+            FD_SET(repl_sd, &read_fdset);
+            if (select(repl_sd + 1, &read_fdset, NULL, NULL, &timeout) <= 0)
+                break; // resend to the ones still missing
+
+            struct sockaddr_in from;
+            MSG_t ack;
+            if (UDP_Read(repl_sd, &from, (char *)&ack, sizeof(MSG_t)) <= 0)
+                continue;
+
+            backup_t *b = find_backup(&from);
+            if (b == NULL || b->acked || ack.seq != msg->seq)
+                continue; // stale ack for an earlier op
+
+            b->acked = 1;
+            pending--;
+            if (ack.flags & MSG_REPL_GAP)
+            {
+                b->live = 0;
+                LOG(TRACE_ERROR, "server:: backup %s is out of sync at seq %d, dropped\n", b->name, msg->seq);
+            }
+        }
+    }
+
+    for (int i = 0; i < num_backups; i++)
+    {
+        if (!backups[i].acked)
+        {
+            backups[i].live = 0;
+            LOG(TRACE_ERROR, "server:: backup %s did not ack seq %d, dropped\n", backups[i].name, msg->seq);
+        }
+    }
+}
+
+void repl_start()
+{
+    if (num_backups == 0)
+        return;
+
+    repl_sd = UDP_Open(0);
+    assert(repl_sd > -1);
+
+    MSG_t hello;
+    memset(&hello, 0, sizeof(MSG_t));
+    hello.msg_type = REPL_HELLO_t;
+    hello.flags = MSG_REPLICATED;
+    hello.seq = repl_seq;
+    repl_send_all(&hello);
+}
+
+void repl_forward(MSG_t *request)
+{
+    if (repl_live_backups() == 0)
+        return;
+
+    MSG_t forward;
+    memcpy(&forward, request, msg_request_size(request));
+    forward.flags |= MSG_REPLICATED;
+
+    // a whole 64K block does not fit one datagram: backups get it in pieces,
+    // each written at its own offset within the block
+    int done = 0;
+    do
+    {
+        if (request->msg_type == WRITE_t)
+        {
+            forward.offset = request->offset + done;
+            forward.nbytes = request->nbytes - done < MSG_UDP_IO_MAX ? request->nbytes - done : MSG_UDP_IO_MAX;
+            memcpy(forward.buffer, request->buffer + done, msg_payload(forward.nbytes));
+            done += forward.nbytes;
+        }
+        forward.seq = ++repl_seq;
+        repl_send_all(&forward);
+    } while (request->msg_type == WRITE_t && done < request->nbytes);
+    repl_forwarded++;
+}
+
+// a host whose REPL_HELLO this backup accepts; the primary sends from an
+// ephemeral port, so only the address is kept
+int repl_add_primary(char *host)
+{
+    struct sockaddr_in addr;
+    if (num_primary_hosts == REPL_MAX_PRIMARIES || UDP_FillSockAddr(&addr, host, 0) < 0)
+        return -1;
+    primary_hosts[num_primary_hosts++] = addr.sin_addr;
+    repl_is_backup = 1;
+    return 0;
+}
+
+// whether `from` is the primary this backup follows
+int repl_from_primary(struct sockaddr_in *from)
+{
+    return primary_known && primary_addr.sin_addr.s_addr == from->sin_addr.s_addr &&
+           primary_addr.sin_port == from->sin_port;
+}
+
+// whether a REPL_HELLO from `from` may bind this backup: with -P, only from
+// those hosts; without, from anyone until a primary is known, and then only
+// from its host, where it may come back on a new port after a restart
+int hello_allowed(struct sockaddr_in *from)
+{
+    if (num_primary_hosts == 0)
+        return !primary_known || primary_addr.sin_addr.s_addr == from->sin_addr.s_addr;
+
+    for (int i = 0; i < num_primary_hosts; i++)
+    {
+        if (primary_hosts[i].s_addr == from->sin_addr.s_addr)
+            return 1;
+    }
+    return 0;
+}
+
+// whether a request flagged MSG_REPLICATED comes from a primary; if not, the
+// caller treats it as a client's. Refused HELLOs are counted and logged.
+int repl_accept(struct sockaddr_in *from, MSG_t *request)
+{
+    if (request->msg_type != REPL_HELLO_t)
+        return repl_from_primary(from);
+    if (hello_allowed(from))
+        return 1;
+
+    repl_rejected_hellos++;
+    LOG(TRACE_ERROR, "server:: ignored REPL_HELLO from %s:%d, not a primary\n",
+        inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    return 0;
+}
+
+// returns 1 when `response` is already filled in and the request must not be
+// applied, 0 when the caller should handle it
+int repl_backup_filter(struct sockaddr_in *from, MSG_t *request, MSG_t *response)
+{
+    if (!(request->flags & MSG_REPLICATED))
+    {
+        if (!msg_is_mutation(request->msg_type) || request->msg_type == SHUTDOWN_t)
+            return 0;
+
+        response->rc = -1;
+        response->flags |= MSG_NOT_PRIMARY;
+        return 1;
+    }
+
+    if (request->msg_type == REPL_HELLO_t)
+    {
+        primary_addr = *from;
+        primary_known = 1;
+        applied_seq = request->seq;
+        applied_rc = 0;
+        LOG(TRACE_ERROR, "server:: following primary %s:%d from seq %d\n",
+            inet_ntoa(from->sin_addr), ntohs(from->sin_port), applied_seq);
+        response->rc = 0;
+        return 1;
+    }
+
+    if (!repl_from_primary(from))
+    {
+        response->rc = -1;
+        return 1;
+    }
+
+    if (request->seq <= applied_seq) // resent by the primary, already applied
+    {
+        response->rc = request->seq == applied_seq ? applied_rc : 0;
+        return 1;
+    }
+
+    if (request->seq > applied_seq + 1)
+    {
+        LOG(TRACE_ERROR, "server:: missed replicated ops %d..%d\n", applied_seq + 1, request->seq - 1);
+        response->rc = -1;
+        response->flags |= MSG_REPL_GAP;
+        return 1;
+    }
+    return 0;
+}
+
+void repl_backup_applied(MSG_t *request, MSG_t *response)
+{
+    if (request->flags & MSG_REPLICATED)
+    {
+        applied_seq = request->seq;
+        applied_rc = response->rc;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef __REPL_h__
+#define __REPL_h__
+
+#include "udp.h"
+#include "msg.h"
+
+#define REPL_MAX_BACKUPS (8)
+#define REPL_MAX_PRIMARIES (8) // hosts a backup takes a REPL_HELLO from
+#define REPL_TIMEOUT_MS (500) // per attempt, before resending to a backup
+#define REPL_RETRIES (5)      // attempts before a backup is dropped
+
+// primary side: every successful mutation is forwarded, with the primary's
+// own sequence number, to each live backup and acknowledged before the
+// client gets its reply
+int repl_add_backup(char *host_port);
+void repl_start();
+void repl_forward(MSG_t *request);
+int repl_live_backups();
+extern unsigned long long repl_forwarded;
+
+// backup side: only replicated mutations from the primary are applied, in
+// sequence order; clients may still LOOKUP, STAT and READ
+extern int repl_is_backup;
+extern unsigned long long repl_rejected_hellos;
+int repl_add_primary(char *host);
+int repl_from_primary(struct sockaddr_in *from);
+int repl_accept(struct sockaddr_in *from, MSG_t *request);
+int repl_backup_filter(struct sockaddr_in *from, MSG_t *request, MSG_t *response);
+void repl_backup_applied(MSG_t *request, MSG_t *response);
+
+#endif // __REPL_h__
@@ -0,0 +1,254 @@
+#include "sched.h"
+
+typedef struct flow
+{
+    struct sockaddr_in addr;
+    struct flow *hash_next;
+    struct flow *active_next[SCHED_CLASSES]; // ring of flows with work in a class
+    sched_entry_t *head[SCHED_CLASSES];
+    sched_entry_t *tail[SCHED_CLASSES];
+    int depth[SCHED_CLASSES];
+    int deficit[SCHED_CLASSES];
+    int queued; // over both classes; the flow is released at 0
+} flow_t;
+
+sched_entry_t entry_pool[SCHED_MAX_QUEUED];
+sched_entry_t *free_entries;
+flow_t flow_pool[SCHED_FLOWS];
+flow_t *free_flows;
+flow_t *flow_hash[SCHED_FLOWS];
+
+// per class: the ring of active flows (the tail; tail->next is served next)
+flow_t *active_tail[SCHED_CLASSES];
+int class_weight[SCHED_CLASSES] = {2, 1};
+int class_deficit[SCHED_CLASSES];
+int current_class = SCHED_META;
+
+int queued = 0;
+unsigned long long avg_service_ns = 100000; // EWMA, for retry-after
+
+void sched_init()
+{
+    free_entries = NULL;
+    for (int i = SCHED_MAX_QUEUED - 1; i >= 0; i--)
+    {
+        entry_pool[i].next = free_entries;
+        free_entries = &entry_pool[i];
+    }
+    free_flows = NULL;
+    for (int i = SCHED_FLOWS - 1; i >= 0; i--)
+    {
+        flow_pool[i].hash_next = free_flows;
+        free_flows = &flow_pool[i];
+    }
+}
+
+int sched_set_weights(char *meta_data)
+{
+    int meta, data;
+    if (sscanf(meta_data, "%d:%d", &meta, &data) != 2 || meta < 1 || data < 1)
+        return -1;
+    class_weight[SCHED_META] = meta;
+    class_weight[SCHED_DATA] = data;
+    return 0;
+}
+
+int request_class(MSG_t *msg)
+{
+    switch (msg->msg_type)
+    {
+    case READ_t:
+    case WRITE_t:
+    case COPY_t:
+    case CLONE_t:
+        return SCHED_DATA;
+    default:
+        return SCHED_META;
+    }
+}
+
+// what serving the request moves: the request plus the READ data coming back
+int request_cost(sched_entry_t *e)
+{
+    return e->nbytes + (e->msg->msg_type == READ_t ? msg_payload(e->msg->nbytes) : 0);
+}
+
+// room for the request as received and, for a compressed WRITE, as unpacked
+int entry_size(MSG_t *msg, int nbytes)
+{
+    int unpacked = MSG_HEADER_SIZE + (msg->msg_type == WRITE_t ? msg_payload(msg->nbytes) : 0);
+    return nbytes > unpacked ? nbytes : unpacked;
+}
+
+unsigned int flow_hash_of(struct sockaddr_in *addr)
+{
+    return (addr->sin_addr.s_addr * 2654435761u ^ addr->sin_port) % SCHED_FLOWS;
+}
+
+flow_t *find_flow(struct sockaddr_in *addr, int create)
+{
+    unsigned int h = flow_hash_of(addr);
+    for (flow_t *f = flow_hash[h]; f != NULL; f = f->hash_next)
+    {
+        if (f->addr.sin_addr.s_addr == addr->sin_addr.s_addr && f->addr.sin_port == addr->sin_port)
+            return f;
+    }
+    if (!create || free_flows == NULL)
+        return NULL;
+
+    flow_t *f = free_flows;
+    free_flows = f->hash_next;
+    memset(f, 0, sizeof(flow_t));
+    f->addr = *addr;
+    f->hash_next = flow_hash[h];
+    flow_hash[h] = f;
+    return f;
+}
+
+void release_flow(flow_t *f)
+{
+    flow_t **p = &flow_hash[flow_hash_of(&f->addr)];
+    while (*p != f)
+        p = &(*p)->hash_next;
+    *p = f->hash_next;
+    f->hash_next = free_flows;
+    free_flows = f;
+}
+
+int sched_enqueue(struct sockaddr_in *addr, MSG_t *msg, int nbytes, unsigned long long now)
+{
+    // no flow is set up for a request turned away, or it would never be released
+    int c = request_class(msg);
+    if (free_entries == NULL)
+        return -1;
+    flow_t *f = find_flow(addr, 1);
+    if (f == NULL || f->depth[c] >= SCHED_FLOW_DEPTH)
+        return -1;
+    MSG_t *copy = malloc(entry_size(msg, nbytes));
+    if (copy == NULL)
+    {
+        if (f->queued == 0)
+            release_flow(f);
+        return -1;
+    }
+    memcpy(copy, msg, nbytes);
+
+    sched_entry_t *e = free_entries;
+    free_entries = e->next;
+    e->next = NULL;
+    e->addr = *addr;
+    e->nbytes = nbytes;
+    e->arrival_ns = now;
+    e->msg = copy;
+
+    if (f->tail[c] != NULL)
+        f->tail[c]->next = e;
+    else
+    {
+        f->head[c] = e;
+        // joins the class ring just before the flow served next
+        if (active_tail[c] == NULL)
+            f->active_next[c] = f;
+        else
+        {
+            f->active_next[c] = active_tail[c]->active_next[c];
+            active_tail[c]->active_next[c] = f;
+        }
+        active_tail[c] = f;
+    }
+    f->tail[c] = e;
+    f->depth[c]++;
+    f->queued++;
+    queued++;
+    return 0;
+}
+
+// DRR over the flows of class c: returns the next entry or NULL when the
+// class has run out of credit (or work) for this turn
+sched_entry_t *next_in_class(int c)
+{
+    while (active_tail[c] != NULL)
+    {
+        flow_t *prev = active_tail[c];
+        flow_t *f = prev->active_next[c];
+        sched_entry_t *e = f->head[c];
+        int cost = request_cost(e);
+
+        if (f->deficit[c] < cost)
+        {
+            f->deficit[c] += SCHED_QUANTUM;
+            active_tail[c] = f; // to the back of the ring
+            continue;
+        }
+        if (class_deficit[c] < cost)
+            return NULL;
+
+        f->deficit[c] -= cost;
+        class_deficit[c] -= cost;
+        f->head[c] = e->next;
+        if (f->head[c] == NULL)
+        {
+            // leaves the ring; an idle flow keeps no credit
+            f->tail[c] = NULL;
+            f->deficit[c] = 0;
+            if (f == prev)
+                active_tail[c] = NULL;
+            else
+                prev->active_next[c] = f->active_next[c];
+        }
+        f->depth[c]--;
+        return e;
+    }
+    return NULL;
+}
+
+sched_entry_t *sched_next()
+{
+    if (queued == 0)
+        return NULL;
+
+    // weighted DRR between the classes, over whole turns. Each turn gives an
+    // active class credit for the bytes of its weight; a large request waits
+    // for as many turns as it takes, so this ends once enough has built up.
+    while (1)
+    {
+        int c = current_class;
+        sched_entry_t *e = active_tail[c] != NULL ? next_in_class(c) : NULL;
+        if (e != NULL)
+        {
+            flow_t *f = find_flow(&e->addr, 0);
+            queued--;
+            if (--f->queued == 0)
+                release_flow(f);
+            return e;
+        }
+
+        if (active_tail[c] == NULL)
+            class_deficit[c] = 0;
+        current_class = (c + 1) % SCHED_CLASSES;
+        if (active_tail[current_class] != NULL)
+            class_deficit[current_class] += class_weight[current_class] * SCHED_QUANTUM;
+    }
+}
+
+void sched_done(sched_entry_t *e, unsigned long long service_ns)
+{
+    avg_service_ns = (avg_service_ns * 7 + service_ns) / 8;
+    free(e->msg);
+    e->msg = NULL;
+    e->next = free_entries;
+    free_entries = e;
+}
+
+int sched_queued()
+{
+    return queued;
+}
+
+int sched_retry_after_ms()
+{
+    unsigned long long ms = (unsigned long long)queued * avg_service_ns / 1000000;
+    if (ms < 1)
+        return 1;
+    return ms > 1000 ? 1000 : (int)ms;
+}
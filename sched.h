@@ -0,0 +1,41 @@
+#ifndef __SCHED_h__
+#define __SCHED_h__
+
+#include "udp.h"
+#include "msg.h"
+
+#define SCHED_MAX_QUEUED (1024) // requests waiting, over all clients
+#define SCHED_FLOW_DEPTH (64)   // per client and class
+#define SCHED_FLOWS (1024)      // clients with queued requests
+#define SCHED_QUANTUM (512)     // bytes of credit per round
+
+#define SCHED_META 0 // LOOKUP, STAT, CREAT, UNLINK, ...
+#define SCHED_DATA 1 // READ, WRITE, COPY, CLONE
+#define SCHED_CLASSES 2
+
+// A queued UDP request. Each client address has one FIFO per class; clients
+// within a class, and the two classes, take turns by deficit round-robin,
+// charged the bytes the request moves. The message is allocated at the size
+// it was received at (or unpacks to), not as a whole MSG_t.
+typedef struct __sched_entry_t {
+    struct __sched_entry_t *next;
+    struct sockaddr_in addr;
+    int nbytes; // as received
+    unsigned long long arrival_ns;
+    MSG_t *msg;
+} sched_entry_t;
+
+void sched_init();
+int sched_set_weights(char *meta_data); // "meta:data", e.g. "4:1"
+
+// returns -1 when the client's queue or the whole pool is full, or there is
+// no memory for the message
+int sched_enqueue(struct sockaddr_in *addr, MSG_t *msg, int nbytes, unsigned long long now);
+// the next request to serve, or NULL; hand it back to sched_done
+sched_entry_t *sched_next();
+void sched_done(sched_entry_t *e, unsigned long long service_ns);
+
+int sched_queued();
+int sched_retry_after_ms(); // what a busy reply tells the client
+
+#endif // __SCHED_h__
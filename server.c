@@ -1,28 +1,65 @@
 #include <stdio.h>
-#include <sys/stat.h>
-#include <sys/mman.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
 
 #include "udp.h"
 #include "mfs.h"
 #include "ufs.h"
+#include "server_core.h"
 #include "msg.h"
-
-#define BUFFER_SIZE 4096
-
-typedef struct
-{
-    dir_ent_t entries[BUFFER_SIZE / sizeof(dir_ent_t)];
-} dir_pack_t;
+#include "stats.h"
+#include "trace.h"
+#include "repl.h"
+#include "shm.h"
+#include "stream.h"
+#include "lz.h"
+#include "watch.h"
+#include "sched.h"
+#include "checkpoint.h"
+
+#define DEDUP_SLOTS 256
+#define MAX_EVENTS 64
+#define UDP_BATCH 64    // datagrams read per readable event
+#define DISPATCH_BATCH 4 // queued requests served between polls
 
 // global vars
-inode_t empty_inode;
-int server_img_fd;
 int sd;
-int *server_file;
-super_t *superblock_addr;
-inode_t *inode_area;
-dir_pack_t *data_area;
+MFS_Stats_t server_stats;
+unsigned long long server_start_ns;
+pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER; // main loop vs shm sessions
+int epfd;
+char *unix_path = NULL; // -u: removed again at shutdown
+lz_adapt_t reply_adapt; // READ replies
+
+// an epoll source: the UDP socket, a stream listener or a stream session.
+// A session's buffers start at a 4K block's frame and grow, up to
+// STREAM_FRAME_MAX, only once a frame needs more.
+typedef struct
+{
+    int fd;
+    int kind;
+    int in_len;   // bytes of the next request frame(s) received so far
+    int out_len;  // reply frame still to be sent, from out_done on
+    int out_done;
+    int in_cap;
+    int out_cap;
+    char *in;
+    char *out;
+} conn_t;
+
+#define CONN_BUF_MIN (4 + MSG_HEADER_SIZE + MFS_BLOCK_SIZE)
+
+#define CONN_UDP 0
+#define CONN_LISTEN 1
+#define CONN_STREAM 2
+
+// last request seen from each client (hashed by address), for duplicate counts
+struct
+{
+    struct sockaddr_in addr;
+    int seq;
+} last_request[DEDUP_SLOTS];
 
 void interruption_handler()
 {
@@ -32,438 +69,646 @@ void interruption_handler()
 
 void print_usage()
 {
-    fprintf(stderr, "usage: server [portnum] [file-system-image]\n");
+    fprintf(stderr, "usage: server [-b backup_host:port]... [-B] [-P primary_host]... [-t tcp_port] [-u unix_path] [-W meta:data] [-c interval_s] [-C dirty_kb] [portnum] [file-system-image]\n");
     exit(1);
 }
 
-void *block_addr_to_addr(int block_addr)
+void stats_record_request(struct sockaddr_in *addr, MSG_t *request, int nbytes)
 {
-    return (char *)superblock_addr + block_addr * BUFFER_SIZE;
+    server_stats.bytes_in += nbytes;
+    if (request->msg_type > 0 && request->msg_type < STATS_OPS)
+        server_stats.ops[request->msg_type]++;
+    if (request->attempt > 0)
+        server_stats.retransmits++;
+    if (addr == NULL)
+        return; // shm requests are never duplicated
+
+    int slot = (addr->sin_addr.s_addr ^ addr->sin_port) % DEDUP_SLOTS;
+    if (last_request[slot].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+        last_request[slot].addr.sin_port == addr->sin_port &&
+        last_request[slot].seq == request->seq && request->seq != 0)
+    {
+        server_stats.duplicates++;
+        TRACE(TRACE_INFO, TRACE_DUP, request->msg_type, request->inum, 0, request->seq, 0);
+    }
+
+    last_request[slot].addr = *addr;
+    last_request[slot].seq = request->seq;
 }
 
-int get_ith_bit(unsigned int *bitmap, int ith)
+void stats_record_reply(MSG_t *request, MSG_t *response, int nbytes, unsigned long long start_ns)
 {
-    int block_idx = ith / 32;
-    int offset = 31 - (ith % 32);
-    return (bitmap[block_idx] >> offset) & 0x1;
+    unsigned long long dur_ns = trace_now_ns() - start_ns;
+    TRACE(response->rc < 0 ? TRACE_ERROR : TRACE_INFO, TRACE_REQUEST,
+          request->msg_type, request->inum, response->rc, request->nbytes, dur_ns);
+
+    server_stats.bytes_out += nbytes;
+    if (request->msg_type <= 0 || request->msg_type >= STATS_OPS)
+        return;
+
+    if (response->rc < 0)
+        server_stats.errors[request->msg_type]++;
+    server_stats.latency[request->msg_type][stats_bucket(dur_ns / 1000)]++;
 }
 
-void set_ith_bit(unsigned int *bitmap, int ith, int val)
+void stats_snapshot(MFS_Stats_t *s)
 {
-    // val should be either 0 or 1.
-    int block_idx = ith / 32;
-    int offset = 31 - (ith % 32);
-    if (val)
-        bitmap[block_idx] |= 0x1 << offset;
-    else
-        bitmap[block_idx] &= ~(0x1 << offset);
+    server_stats.uptime_us = (trace_now_ns() - server_start_ns) / 1000;
+    server_stats.num_inodes = superblock_addr->num_inodes;
+    server_stats.free_inodes = count_free_bits(block_addr_to_addr(superblock_addr->inode_bitmap_addr),
+                                               superblock_addr->num_inodes);
+    server_stats.num_data = superblock_addr->num_data;
+    server_stats.free_data = count_free_bits(block_addr_to_addr(superblock_addr->data_bitmap_addr),
+                                             superblock_addr->num_data);
+    server_stats.repl_forwarded = repl_forwarded;
+    server_stats.repl_rejected_hellos = repl_rejected_hellos;
+    server_stats.repl_backups = repl_live_backups();
+    server_stats.watches = watch_count();
+    server_stats.queued = sched_queued();
+    server_stats.checkpoints = checkpoint_count;
+    server_stats.checkpoint_failures = checkpoint_failures;
+    server_stats.dirty_bytes = __atomic_load_n(&checkpoint_dirty_bytes, __ATOMIC_RELAXED);
+    server_stats.checkpoint_pause_us = checkpoint_pause_us;
+    server_stats.checkpoint_max_pause_us = checkpoint_max_pause_us;
+    server_stats.checkpoint_ms = checkpoint_ms;
+    server_stats.block_size = block_size;
+    memcpy(s, &server_stats, sizeof(MFS_Stats_t));
 }
 
-int get_available_inum()
+int serve_session_request(MSG_t *request_msg, MSG_t *response_msg);
+void server_shutdown();
+
+int is_directory(int inum)
 {
-    for (int i = 0; i < superblock_addr->num_inodes; i++)
-    {
-        int t = get_ith_bit(block_addr_to_addr(superblock_addr->inode_bitmap_addr), i);
-        if (t == 0)
-            return i;
-    }
-    return -1; // not found
+    return inum >= 0 && inum < superblock_addr->num_inodes &&
+           get_ith_bit(block_addr_to_addr(superblock_addr->inode_bitmap_addr), inum) &&
+           inode_area[inum].type == MFS_DIRECTORY;
 }
 
-int get_available_datablock()
+// fills in `response_msg`; returns -1 for an unknown msg_type. `addr` is the
+// client's, NULL for session requests.
+int handle_request(struct sockaddr_in *addr, MSG_t *request_msg, MSG_t *response_msg)
 {
-    for (int i = 0; i < superblock_addr->num_data; i++)
+    int existing;
+    switch (request_msg->msg_type)
     {
-        int t = get_ith_bit(block_addr_to_addr(superblock_addr->data_bitmap_addr), i);
-        if (t == 0)
-            return i;
+    case INIT_t:
+        LOG(TRACE_DEBUG, "server:: init\n");
+        response_msg->rc = 0;
+        response_msg->nbytes = max_file_blocks * block_size; // largest file the image holds
+        response_msg->offset = block_size;
+        break;
+
+    case LOOKUP_t:
+        LOG(TRACE_DEBUG, "server:: lookup\n");
+        response_msg->rc = server_lookup(request_msg->inum, request_msg->name);
+        break;
+
+    case STAT_t:
+        LOG(TRACE_DEBUG, "server:: stat\n");
+        response_msg->rc = -1;
+        inode_t inode = server_stat(request_msg->inum);
+
+        response_msg->rc = 0;
+        response_msg->nbytes = inode.size;
+        response_msg->type = inode.type;
+        LOG(TRACE_DEBUG, "size: %d, type: %d\n", response_msg->nbytes, response_msg->type);
+        break;
+
+    case WRITE_t:
+        LOG(TRACE_DEBUG, "server:: write\n");
+        response_msg->rc = server_write(request_msg->inum, request_msg->buffer, request_msg->offset, request_msg->nbytes);
+        break;
+
+    case READ_t:
+        LOG(TRACE_DEBUG, "server:: read\n");
+        response_msg->rc = server_read(request_msg->inum, response_msg->buffer, request_msg->offset, request_msg->nbytes);
+        break;
+
+    case CREAT_t:
+        LOG(TRACE_DEBUG, "server:: create\n");
+        existing = server_lookup(request_msg->inum, request_msg->name);
+        response_msg->rc = server_create(request_msg->inum, request_msg->type, request_msg->name);
+        if (response_msg->rc == 0 && existing == -1)
+            watch_notify(request_msg->inum, MFS_WATCH_CREATED,
+                         server_lookup(request_msg->inum, request_msg->name), request_msg->name);
+        break;
+
+    case UNLINK_t:
+        LOG(TRACE_DEBUG, "server:: unlink\n");
+        existing = server_lookup(request_msg->inum, request_msg->name);
+        response_msg->rc = server_unlink(request_msg->inum, request_msg->name);
+        if (response_msg->rc == 0 && existing != -1)
+            watch_notify(request_msg->inum, MFS_WATCH_REMOVED, existing, request_msg->name);
+        break;
+
+    case WATCH_t:
+        LOG(TRACE_DEBUG, "server:: watch\n");
+        response_msg->rc = -1;
+        if (addr == NULL || !is_directory(request_msg->inum))
+            break; // events are datagrams: only UDP clients can watch
+
+        struct sockaddr_in event_addr = *addr;
+        event_addr.sin_port = htons(request_msg->offset);
+        int created;
+        int seq = watch_add(&event_addr, request_msg->inum, request_msg->nbytes, &created);
+        if (seq < 0)
+            break;
+        response_msg->rc = 0;
+        response_msg->nbytes = seq;
+        response_msg->type = created;
+        break;
+
+    case COPY_t:
+    case CLONE_t:
+        LOG(TRACE_DEBUG, "server:: copy\n");
+        response_msg->rc = server_copy(request_msg->inum, request_msg->type, request_msg->offset, request_msg->nbytes,
+                                       request_msg->msg_type == CLONE_t);
+        break;
+
+    case TRACE_t:
+        LOG(TRACE_DEBUG, "server:: trace\n");
+        if (request_msg->type >= TRACE_OFF)
+            trace_set_level(request_msg->type);
+        response_msg->rc = request_msg->nbytes ? trace_dump(trace_path) : 0;
+        break;
+
+    case STATS_t:
+        LOG(TRACE_DEBUG, "server:: stats\n");
+        stats_snapshot((MFS_Stats_t *)response_msg->buffer);
+        response_msg->rc = 0;
+        response_msg->nbytes = sizeof(MFS_Stats_t);
+        break;
+
+    case SHM_ATTACH_t:
+        LOG(TRACE_DEBUG, "server:: shm attach\n");
+        response_msg->rc = shm_attach(request_msg, serve_session_request, server_shutdown);
+        break;
+
+    case SHUTDOWN_t:
+        LOG(TRACE_DEBUG, "server:: shutdown\n");
+        response_msg->rc = 0; // the image is saved once the reply is out
+        break;
+
+    default:
+        return -1;
     }
-    return -1; // not found
+    return 0;
 }
 
-int server_lookup(int pinum, char *name)
+// the caller must not hold server_lock; it is kept until exit so no other
+// request touches the image after it is saved
+void server_shutdown()
 {
-    if (pinum < 0 || pinum >= superblock_addr->num_inodes)
-        return -1;
-
-    if (inode_area[pinum].type != MFS_DIRECTORY)
-        return -1;
-
-    for (int i = 0; i < DIRECT_PTRS; i++)
-    {
-        if (inode_area[pinum].direct[i] == -1)
-            continue;
-
-        int block_idx = inode_area[pinum].direct[i] - superblock_addr->data_region_addr;
-
-        for (int j = 0; j < 128; j++)
-        {
-            dir_ent_t entry = data_area[block_idx].entries[j];
+    pthread_mutex_lock(&server_lock);
+    checkpoint_wait(); // an older snapshot must not land after this save
+    save_server_file();
 
-            if (strcmp(entry.name, name) == 0)
-                return entry.inum;
-        }
-    }
-    return -1;
+    UDP_Close(sd);
+    if (unix_path != NULL)
+        unlink(unix_path);
+    server_close_image();
+    LOG(TRACE_DEBUG, "server:: exiting...\n");
+    exit(0);
 }
 
-inode_t server_stat(int inum)
+void stats_record_payload(MSG_t *msg, int nbytes, int packed)
 {
-    if (inum < 0 || inum >= superblock_addr->num_inodes)
-        return empty_inode;
+    server_stats.payload_raw += msg_payload(nbytes);
+    server_stats.payload_wire += msg_wire_payload(msg, nbytes);
+    server_stats.compressed += packed == LZ_PACKED;
+    server_stats.compress_skipped += packed == LZ_SKIPPED;
+}
 
-    return inode_area[inum];
+// roughly how much of the image a successful mutation changed, towards the
+// next checkpoint
+long long dirtied_bytes(MSG_t *request_msg)
+{
+    switch (request_msg->msg_type)
+    {
+    case WRITE_t:
+    case COPY_t:
+        return request_msg->nbytes;
+    case SHUTDOWN_t:
+        return 0;
+    default:
+        return sizeof(inode_t) + sizeof(dir_ent_t);
+    }
 }
 
-int server_write(int inum, char *buffer, int offset, int nbytes)
+// replication filter, handler and forwarding around handle_request, and
+// payload (de)compression; `addr` is NULL for session requests. Returns -1
+// for an unknown msg_type.
+int process_request(struct sockaddr_in *addr, MSG_t *request_msg, MSG_t *response_msg)
 {
-    if (nbytes < 0 || nbytes > BUFFER_SIZE || offset / BUFFER_SIZE >= 30)
-        return -1;
+    response_msg->seq = request_msg->seq;
+    response_msg->flags = request_msg->flags & MSG_COMPRESS_OK;
 
-    if (inum < 0 || inum >= superblock_addr->num_inodes)
-        return -1;
+    if (request_msg->msg_type == WRITE_t)
+    {
+        stats_record_payload(request_msg, request_msg->nbytes, request_msg->flags & MSG_COMPRESSED ? LZ_PACKED : LZ_RAW);
+        if (msg_unpack(request_msg, request_msg->nbytes) < 0)
+        {
+            response_msg->rc = -1;
+            return 0;
+        }
+    }
 
-    if (inode_area[inum].type == MFS_DIRECTORY)
+    if (repl_is_backup && repl_backup_filter(addr, request_msg, response_msg))
+        return 0; // answered without touching the image
+    if (handle_request(addr, request_msg, response_msg) < 0)
+    {
+        server_stats.bad_requests++;
         return -1;
+    }
 
-    int block_idx = inode_area[inum].direct[offset / BUFFER_SIZE] - superblock_addr->data_region_addr;
-    memcpy(&data_area[block_idx].entries, buffer, nbytes);
+    if (msg_is_mutation(request_msg->msg_type) && response_msg->rc == 0)
+        checkpoint_dirty(dirtied_bytes(request_msg));
+    if (repl_is_backup)
+        repl_backup_applied(request_msg, response_msg);
+    else if (msg_is_mutation(request_msg->msg_type) && response_msg->rc == 0)
+        repl_forward(request_msg);
 
-    inode_area[inum].size += nbytes;
+    if (request_msg->msg_type == READ_t && response_msg->rc == 0)
+    {
+        int packed = LZ_SKIPPED;
+        if (request_msg->flags & MSG_COMPRESS_OK)
+            packed = msg_pack(response_msg, request_msg->nbytes, &reply_adapt);
+        stats_record_payload(response_msg, request_msg->nbytes, packed);
+    }
     return 0;
 }
 
-int server_read(int inum, char *buffer, int offset, int nbytes)
+// a request from an shm or stream session, which has no address and is never
+// resent; returns 1 once the reply to a SHUTDOWN has been built
+int serve_session_request(MSG_t *request_msg, MSG_t *response_msg)
 {
-    if (nbytes < 0 || nbytes > BUFFER_SIZE || offset / BUFFER_SIZE >= 30)
-        return -1;
+    request_msg->flags &= ~MSG_REPLICATED; // only the primary's UDP socket replicates
 
-    int block_idx = inode_area[inum].direct[offset / BUFFER_SIZE] - superblock_addr->data_region_addr;
-    if (inode_area[inum].type == MFS_REGULAR_FILE)
-        memcpy(buffer, &data_area[block_idx].entries, nbytes);
-    else
-        memcpy((MFS_DirEnt_t *)buffer, &data_area[block_idx].entries, nbytes);
-    return 0;
+    pthread_mutex_lock(&server_lock);
+    unsigned long long start_ns = trace_now_ns();
+    stats_record_request(NULL, request_msg, msg_request_size(request_msg));
+    if (process_request(NULL, request_msg, response_msg) < 0)
+        response_msg->rc = -1; // the client is waiting for a reply either way
+    stats_record_reply(request_msg, response_msg, msg_reply_size(request_msg, response_msg), start_ns);
+    pthread_mutex_unlock(&server_lock);
+
+    return request_msg->msg_type == SHUTDOWN_t;
 }
 
-int server_create(int pinum, int type, char *name)
+// serves one UDP request; `start_ns` is when it arrived, so time spent
+// queued counts towards its latency
+void serve_udp(struct sockaddr_in *addr, MSG_t *request_msg, int nbytes, unsigned long long start_ns)
 {
-    if (strlen(name) > 28)
-    {
-        printf("server:: invalid name, creating failed.");
-        return -1;
-    }
+    pthread_mutex_lock(&server_lock);
+    stats_record_request(addr, request_msg, nbytes);
 
-    if (pinum < 0 || pinum >= superblock_addr->num_inodes)
-        return -1;
-
-    if (inode_area[pinum].type != MFS_DIRECTORY)
+    MSG_t response_msg;
+    if (process_request(addr, request_msg, &response_msg) < 0)
     {
-        printf("server:: parent type != MFS_DIRECTORY, creating failed.");
-        return -1;
+        pthread_mutex_unlock(&server_lock);
+        return;
     }
 
-    int block_idx = inode_area[pinum].direct[0] - superblock_addr->data_region_addr;
-    int next_inum = get_available_inum();
-    printf("server:: next inum: %d\n", next_inum);
-
-    for (int i = 0; i < BUFFER_SIZE / sizeof(dir_ent_t); i++)
+    int len = msg_reply_size(request_msg, &response_msg);
+    if (len > MSG_UDP_MAX) // a whole 64K block: clients read those in halves
     {
-        if (data_area[block_idx].entries[i].inum == -1)
-        {
-            printf("server:: block %d's inum is written to %d\n", i, next_inum);
-
-            // data block setup
-            data_area[block_idx].entries[i].inum = next_inum;
-            strcpy(data_area[block_idx].entries[i].name, name);
-
-            set_ith_bit(block_addr_to_addr(superblock_addr->inode_bitmap_addr), next_inum, 1);
-            inode_area[pinum].size += sizeof(dir_ent_t);
-            break;
-        }
+        response_msg.rc = -1;
+        len = MSG_HEADER_SIZE;
     }
+    int rc = UDP_Write(sd, addr, (char *)&response_msg, len);
+    stats_record_reply(request_msg, &response_msg, rc > 0 ? rc : 0, start_ns);
+    pthread_mutex_unlock(&server_lock);
 
-    inode_area[next_inum].type = type;
-
-    if (type == MFS_DIRECTORY) // new directory
-    {
-        inode_area[next_inum].size = 2 * sizeof(dir_ent_t);
+    if (request_msg->msg_type == SHUTDOWN_t)
+        server_shutdown();
+}
 
-        dir_ent_t entries[128];
-        strcpy(entries[0].name, "."); // current dir
-        entries[0].inum = next_inum;
-        strcpy(entries[1].name, ".."); // parent dir
-        entries[1].inum = pinum;
+// queues overflowed: tell the client when to come back instead of dropping
+void reply_busy(struct sockaddr_in *addr, MSG_t *request_msg)
+{
+    MSG_t response_msg;
+    response_msg.rc = -1;
+    response_msg.seq = request_msg->seq;
+    response_msg.flags = MSG_BUSY;
+    response_msg.offset = sched_retry_after_ms();
+    UDP_Write(sd, addr, (char *)&response_msg, MSG_HEADER_SIZE);
+
+    server_stats.busy++;
+    TRACE(TRACE_INFO, TRACE_BUSY, request_msg->msg_type, request_msg->inum, sched_queued(), request_msg->seq, 0);
+}
 
-        for (int i = 1; i < DIRECT_PTRS; i++)
-        {
-            inode_area[next_inum].direct[i] = -1; // unused
-        }
-        for (int i = 2; i < BUFFER_SIZE / sizeof(dir_ent_t); i++)
+// drains the (non-blocking) UDP socket into the scheduler's queues. Traffic
+// between replicas skips them: the primary waits on its backups in order.
+void recv_udp()
+{
+    for (int i = 0; i < UDP_BATCH; i++)
+    {
+        struct sockaddr_in socket_addr;
+        MSG_t request_msg;
+        int rc = UDP_Read(sd, &socket_addr, (char *)&request_msg, sizeof(MSG_t));
+        if (rc <= 0)
+            return;
+        LOG(TRACE_DEBUG, "server:: read message [size:%d, mtype:%d, name:%s, inode:%d]\n", rc, request_msg.msg_type, (char *)request_msg.name, request_msg.inum);
+        if (rc < MSG_HEADER_SIZE || rc < msg_request_size(&request_msg))
         {
-            entries[i].inum = -1; // unused
+            server_stats.bad_requests++; // truncated
+            continue;
         }
 
-        // get 1 datablock
-        int next_datablock = get_available_datablock();
-        inode_area[next_inum].direct[0] = next_datablock + superblock_addr->data_region_addr;
-        set_ith_bit(block_addr_to_addr(superblock_addr->data_bitmap_addr), next_datablock, 1);
-
-        memcpy(&data_area[next_datablock].entries, entries, BUFFER_SIZE);
+        // replicated ops skip the queues, but only on a backup and only from
+        // its primary (or a primary announcing itself); anyone else is a client
+        int replicated = repl_is_backup && (request_msg.flags & MSG_REPLICATED) &&
+                         repl_accept(&socket_addr, &request_msg);
+        if (!replicated)
+            request_msg.flags &= ~MSG_REPLICATED;
+
+        unsigned long long now = trace_now_ns();
+        if (replicated)
+            serve_udp(&socket_addr, &request_msg, rc, now);
+        else if (sched_enqueue(&socket_addr, &request_msg, rc, now) < 0)
+            reply_busy(&socket_addr, &request_msg);
     }
-    else // new file
+}
+
+// serves up to `max` queued requests, in the scheduler's order
+void dispatch_udp(int max)
+{
+    sched_entry_t *e;
+    for (int i = 0; i < max && (e = sched_next()) != NULL; i++)
     {
-        for (int i = 0; i < DIRECT_PTRS; i++)
-        {
-            int next_datablock = get_available_datablock();
-            inode_area[next_inum].direct[i] = next_datablock + superblock_addr->data_region_addr;
-            set_ith_bit(block_addr_to_addr(superblock_addr->data_bitmap_addr), next_datablock, 1);
-        }
+        unsigned long long start_ns = trace_now_ns();
+        serve_udp(&e->addr, e->msg, e->nbytes, e->arrival_ns);
+        sched_done(e, trace_now_ns() - start_ns);
     }
-    return 0;
 }
 
-int server_unlink(int pinum, char *name)
+conn_t *add_conn(int fd, int kind)
 {
-    if (pinum < 0 || pinum >= superblock_addr->num_inodes)
-        return -1;
+    conn_t *conn = calloc(1, sizeof(conn_t));
+    conn->fd = fd;
+    conn->kind = kind;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    return conn;
+}
 
-    if (inode_area[pinum].type == MFS_REGULAR_FILE)
+void close_conn(conn_t *conn)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+// makes `*buf` hold at least `need` bytes, keeping its contents
+int grow_buf(char **buf, int *cap, int need)
+{
+    if (need <= *cap)
+        return 0;
+    if (need > STREAM_FRAME_MAX)
         return -1;
+    int new_cap = *cap > 0 ? *cap : CONN_BUF_MIN;
+    while (new_cap < need)
+        new_cap *= 2;
+    if (new_cap > STREAM_FRAME_MAX)
+        new_cap = STREAM_FRAME_MAX;
+
+    char *p = realloc(*buf, new_cap);
+    if (p == NULL)
+        return -1;
+    *buf = p;
+    *cap = new_cap;
+    return 0;
+}
+
+void accept_conn(conn_t *listener)
+{
+    int fd = accept(listener->fd, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on AF_UNIX
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    add_conn(fd, CONN_STREAM);
+    LOG(TRACE_DEBUG, "server:: stream session %d opened\n", fd);
+}
 
-    int block_idx = inode_area[pinum].direct[0] - superblock_addr->data_region_addr;
-    for (int i = 0; i < BUFFER_SIZE / sizeof(dir_ent_t); i++)
+// sends what the socket takes of the pending reply; returns -1 if the session
+// is gone. While a reply is pending the session is only polled for EPOLLOUT,
+// so a client that stops reading stops being read from.
+int flush_conn(conn_t *conn)
+{
+    while (conn->out_done < conn->out_len)
     {
-        if (strcmp(data_area[block_idx].entries[i].name, name) == 0)
-        {
-            int target_inum = data_area[block_idx].entries[i].inum;
-
-            if (inode_area[target_inum].type == MFS_DIRECTORY) // unlink a directory
-            {
-                // dir is not empty
-                if (inode_area[target_inum].size > 2 * sizeof(dir_ent_t))
-                    return -1;
-
-                int unlink_data_idx = inode_area[target_inum].direct[0] - superblock_addr->data_region_addr;
-                for (int i = 0; i < 2; i++) // delete `.` and `..`
-                {
-                    set_ith_bit(block_addr_to_addr(superblock_addr->inode_bitmap_addr),
-                                data_area[unlink_data_idx].entries[i].inum, 0);
-
-                    data_area[unlink_data_idx].entries[i].inum = -1;
-                    strcpy(data_area[unlink_data_idx].entries[i].name, "\0");
-                }
-                set_ith_bit(block_addr_to_addr(superblock_addr->data_bitmap_addr),
-                            inode_area[target_inum].direct[0] - superblock_addr->data_region_addr, 0);
-
-                inode_area[target_inum].direct[0] = -1;
-            }
-            else // unlink a file
-            {
-                for (int i = 0; i < DIRECT_PTRS; i++)
-                {
-                    int unlink_data_idx = inode_area[target_inum].direct[i] - superblock_addr->data_region_addr;
-
-                    for (int j = 0; j < BUFFER_SIZE / sizeof(dir_ent_t); j++)
-                    {
-                        set_ith_bit(block_addr_to_addr(superblock_addr->inode_bitmap_addr),
-                                    data_area[unlink_data_idx].entries[i].inum, 0);
-                        data_area[unlink_data_idx].entries[i].inum = -1;
-                        strcpy(data_area[unlink_data_idx].entries[i].name, "\0");
-                    }
-                    set_ith_bit(block_addr_to_addr(superblock_addr->data_bitmap_addr),
-                                inode_area[target_inum].direct[i] - superblock_addr->data_region_addr, 0);
-
-                    inode_area[target_inum].direct[i] = -1;
-                }
-            }
-            inode_area[target_inum].size = 0;
-            inode_area[target_inum].type = 0;
-
-            data_area[block_idx].entries[i].inum = -1;
-            strcpy(data_area[block_idx].entries[i].name, "\0");
-
-            inode_area[pinum].size -= sizeof(dir_ent_t);
+        int rc = send(conn->fd, conn->out + conn->out_done, conn->out_len - conn->out_done, MSG_NOSIGNAL);
+        if (rc < 0 && (errno == EAGAIN || errno == EINTR))
             break;
-        }
+        if (rc <= 0)
+            return -1;
+        conn->out_done += rc;
     }
 
+    struct epoll_event ev;
+    ev.events = conn->out_done < conn->out_len ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
     return 0;
 }
 
-void save_server_file()
+// serves complete request frames in `in` for as long as replies go out
+// without blocking; returns -1 if the session must be closed
+int serve_conn(conn_t *conn)
 {
-    lseek(server_img_fd, superblock_addr->inode_bitmap_addr * BUFFER_SIZE, SEEK_SET);
-    write(server_img_fd, block_addr_to_addr(superblock_addr->inode_bitmap_addr), BUFFER_SIZE);
-    printf("server:: inode bitmap saved\n");
+    while (conn->out_done == conn->out_len && conn->in_len >= 4)
+    {
+        uint32_t len;
+        memcpy(&len, conn->in, 4);
+        len = ntohl(len);
+        if (len < MSG_HEADER_SIZE || len > sizeof(MSG_t))
+            return -1; // not our framing
+        if (conn->in_len < 4 + len)
+            break;
 
-    lseek(server_img_fd, superblock_addr->data_bitmap_addr * BUFFER_SIZE, SEEK_SET);
-    write(server_img_fd, block_addr_to_addr(superblock_addr->data_bitmap_addr), BUFFER_SIZE);
-    printf("server:: data bitmap saved\n");
+        MSG_t request_msg, response_msg;
+        memcpy(&request_msg, conn->in + 4, len);
+        if (len < msg_request_size(&request_msg))
+            return -1; // truncated
+        conn->in_len -= 4 + len;
+        memmove(conn->in, conn->in + 4 + len, conn->in_len);
+
+        int shutdown = serve_session_request(&request_msg, &response_msg);
+        int reply_len = msg_reply_size(&request_msg, &response_msg);
+        if (grow_buf(&conn->out, &conn->out_cap, 4 + reply_len) < 0)
+            return -1;
+        conn->out_len = STREAM_Frame(conn->out, &response_msg, reply_len);
+        conn->out_done = 0;
+
+        if (shutdown)
+        {
+            fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) & ~O_NONBLOCK);
+            flush_conn(conn);
+            server_shutdown();
+        }
+        if (flush_conn(conn) < 0)
+            return -1;
+    }
+    return 0;
+}
 
-    for (int i = 0; i < superblock_addr->num_inodes; i++)
+void handle_event(conn_t *conn, int events)
+{
+    if (conn->kind == CONN_UDP)
     {
-        lseek(server_img_fd, i * sizeof(inode_t) + superblock_addr->inode_region_addr * BUFFER_SIZE, SEEK_SET);
-        write(server_img_fd, &inode_area[i], sizeof(inode_t));
+        recv_udp();
+        return;
+    }
+    if (conn->kind == CONN_LISTEN)
+    {
+        accept_conn(conn);
+        return;
     }
-    printf("server:: inode blocks saved\n");
 
-    for (int i = 0; i < superblock_addr->num_data; i++)
+    if (events & EPOLLOUT)
     {
-        lseek(server_img_fd, i * BUFFER_SIZE + superblock_addr->data_region_addr * BUFFER_SIZE, SEEK_SET);
-        write(server_img_fd, &(data_area[i].entries), BUFFER_SIZE);
+        if (flush_conn(conn) < 0)
+        {
+            close_conn(conn);
+            return;
+        }
+    }
+    else if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+    {
+        // a full buffer holds the start of a frame larger than it
+        if (grow_buf(&conn->in, &conn->in_cap, conn->in_len + 1) < 0)
+        {
+            close_conn(conn);
+            return;
+        }
+        int rc = recv(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len, 0);
+        if (rc == 0 || (rc < 0 && errno != EAGAIN && errno != EINTR))
+        {
+            LOG(TRACE_DEBUG, "server:: stream session %d closed\n", conn->fd);
+            close_conn(conn);
+            return;
+        }
+        if (rc > 0)
+            conn->in_len += rc;
     }
-    printf("server:: data blocks saved\n");
-    
 
-    fsync(server_img_fd);
-    printf("server:: fsync completed\n");
+    if (serve_conn(conn) < 0)
+        close_conn(conn);
 }
 
 // server code
 int main(int argc, char *argv[])
 {
+    int ch;
+    int tcp_port = -1;
+    int checkpoint_interval = 0;
+    long long checkpoint_kb = 0;
+    while ((ch = getopt(argc, argv, "b:BP:t:u:W:c:C:")) != -1)
+    {
+        switch (ch)
+        {
+        case 'b':
+            if (repl_add_backup(optarg) < 0)
+                print_usage();
+            break;
+        case 'B':
+            repl_is_backup = 1;
+            break;
+        case 'P':
+            if (repl_add_primary(optarg) < 0)
+                print_usage();
+            break;
+        case 't':
+            tcp_port = atoi(optarg);
+            break;
+        case 'u':
+            unix_path = optarg;
+            break;
+        case 'W':
+            if (sched_set_weights(optarg) < 0)
+                print_usage();
+            break;
+        case 'c':
+            checkpoint_interval = atoi(optarg);
+            break;
+        case 'C':
+            checkpoint_kb = atoll(optarg);
+            break;
+        default:
+            print_usage();
+        }
+    }
+
     // check num of args
-    if (argc != 3)
+    if (argc - optind != 2 || (repl_is_backup && repl_live_backups() > 0))
     {
         print_usage();
     }
 
     // get args
-    int port = atoi(argv[1]);
-    char *fs_img = argv[2];
+    int port = atoi(argv[optind]);
+    char *fs_img = argv[optind + 1];
 
     // initialization
-    empty_inode.type = -1;
-
-    server_img_fd = open(fs_img, O_RDWR, S_IRWXU | S_IRUSR);
-    assert(server_img_fd >= 0);
-
-    struct stat server_img_stat;
-    assert(fstat(server_img_fd, &server_img_stat) >= 0); // get stat info of the server file image
+    trace_init();
+    if (server_load_image(fs_img) < 0)
+    {
+        fprintf(stderr, "image does not exist\n");
+        exit(1);
+    }
 
     sd = UDP_Open(port);
     assert(sd > -1);
-    signal(SIGINT, interruption_handler);
-
-    server_file = mmap(NULL, server_img_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, server_img_fd, 0);
-    superblock_addr = (super_t *)server_file;
-
-    data_area = malloc(BUFFER_SIZE * superblock_addr->num_data);
-    inode_area = malloc(BUFFER_SIZE * superblock_addr->inode_region_len);
-
-    // load data to `data_area`
-    for (int i = 0; i < superblock_addr->num_data; i++)
+    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK); // recv_udp drains it
+    watch_init(sd);
+    sched_init();
+    epfd = epoll_create1(0);
+    assert(epfd > -1);
+    add_conn(sd, CONN_UDP);
+    if (tcp_port >= 0)
     {
-        lseek(server_img_fd, i * BUFFER_SIZE + superblock_addr->data_region_addr * BUFFER_SIZE, SEEK_SET);
-        read(server_img_fd, &(data_area[i].entries), BUFFER_SIZE);
+        int fd = STREAM_Listen_TCP(tcp_port);
+        assert(fd > -1);
+        add_conn(fd, CONN_LISTEN);
     }
-
-    // load inodes to `inode_area`
-    for (int i = 0; i < superblock_addr->num_inodes; i++)
+    if (unix_path != NULL)
     {
-        lseek(server_img_fd, i * sizeof(inode_t) + superblock_addr->inode_region_addr * BUFFER_SIZE, SEEK_SET);
-        read(server_img_fd, &inode_area[i], sizeof(inode_t));
+        int fd = STREAM_Listen_Unix(unix_path);
+        assert(fd > -1);
+        add_conn(fd, CONN_LISTEN);
     }
 
+    signal(SIGINT, interruption_handler);
+    server_start_ns = trace_now_ns();
+    checkpoint_init(checkpoint_interval, checkpoint_kb * 1024);
+    repl_start();
+
     while (1)
     {
-        struct sockaddr_in socket_addr;
-        printf("server:: waiting...\n");
-
-        MSG_t request_msg;
-        int rc = UDP_Read(sd, &socket_addr, (char *)&request_msg, sizeof(MSG_t));
-        printf("server:: read message [size:%d, mtype:%d, name:%s, inode:%d]\n", rc, request_msg.msg_type, (char *)request_msg.name, request_msg.inum);
-
-        if (rc > 0)
-        {
-            MSG_t response_msg;
-            switch (request_msg.msg_type)
-            {
-            case INIT_t:
-                printf("server:: init\n");
-                response_msg.rc = 0;
-                UDP_Write(sd, &socket_addr, (char *)&response_msg, sizeof(MSG_t));
-                break;
-
-            case LOOKUP_t:
-                printf("server:: lookup\n");
-                response_msg.rc = server_lookup(request_msg.inum, request_msg.name);
-                UDP_Write(sd, &socket_addr, (char *)&response_msg, sizeof(MSG_t));
-                break;
-
-            case STAT_t:
-                printf("server:: stat\n");
-                response_msg.rc = -1;
-                inode_t inode = server_stat(request_msg.inum);
-
-                response_msg.rc = 0;
-                response_msg.nbytes = inode.size;
-                response_msg.type = inode.type;
-                printf("size: %d, type: %d\n", response_msg.nbytes, response_msg.type);
-
-                UDP_Write(sd, &socket_addr, (char *)&response_msg, sizeof(MSG_t));
-                break;
-
-            case WRITE_t:
-                printf("server:: write\n");
-                response_msg.rc = server_write(request_msg.inum, request_msg.buffer, request_msg.offset, request_msg.nbytes);
-
-                UDP_Write(sd, &socket_addr, (char *)&response_msg, sizeof(MSG_t));
-                break;
-
-            case READ_t:
-                printf("server:: read\n");
-                char *buffer = (char *)malloc(BUFFER_SIZE);
-                response_msg.rc = server_read(request_msg.inum, buffer, request_msg.offset, request_msg.nbytes);
-                memcpy(response_msg.buffer, buffer, BUFFER_SIZE);
-
-                UDP_Write(sd, &socket_addr, (char *)&response_msg, sizeof(MSG_t));
-                free(buffer);
-                break;
-
-            case CREAT_t:
-                printf("server:: create\n");
-                response_msg.rc = server_create(request_msg.inum, request_msg.type, request_msg.name);
-                UDP_Write(sd, &socket_addr, (char *)&response_msg, sizeof(MSG_t));
-                break;
-
-            case UNLINK_t:
-                printf("server:: unlink\n");
-                response_msg.rc = server_unlink(request_msg.inum, request_msg.name);
-                UDP_Write(sd, &socket_addr, (char *)&response_msg, sizeof(MSG_t));
-                break;
-
-            case SHUTDOWN_t:
-                printf("server:: shutdown\n");
-
-                response_msg.rc = 0;
-                UDP_Write(sd, &socket_addr, (char *)&response_msg, sizeof(MSG_t));
-
-                save_server_file();
-
-                // free(data_area);
-                // free(inode_area);
-                // free(server_file);
-                UDP_Close(sd);
-                close(server_img_fd);
-                printf("server:: exiting...\n");
-                exit(0);
-                break;
-
-            default:
-                break;
-            }
-        }
+        LOG(TRACE_DEBUG, "server:: waiting...\n");
+
+        struct epoll_event events[MAX_EVENTS];
+        // only poll, without waiting, while requests are queued
+        int n = epoll_wait(epfd, events, MAX_EVENTS, sched_queued() > 0 ? 0 : checkpoint_timeout_ms());
+        for (int i = 0; i < n; i++)
+            handle_event(events[i].data.ptr, events[i].events);
+        dispatch_udp(DISPATCH_BATCH);
+        checkpoint_poll(&server_lock);
     }
 
     save_server_file();
 
-    free(data_area);
-    free(inode_area);
-    free(server_file);
     UDP_Close(sd);
-    close(server_img_fd);
+    server_close_image();
 
     return 0;
 }
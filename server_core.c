@@ -0,0 +1,798 @@
+#include <stdio.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "udp.h"
+#include "mfs.h"
+#include "server_core.h"
+#include "trace.h"
+
+// global vars
+inode_t empty_inode;
+int server_img_fd;
+int *server_file;
+off_t server_file_size;
+super_t *superblock_addr;
+inode_t *inode_area;
+char *data_area;
+unsigned int *block_refs;
+int *alloc_goal; // per inode: where its next blocks should go
+int ext_format;  // the image has indirect blocks (mkfs -x)
+int max_file_blocks;
+int block_size;
+int block_shift;
+int indirect_ptrs; // block pointers per indirect block
+
+// last block of pointers found under each file's double indirect block:
+// sequential access walks down from the inode once per indirect_ptrs blocks
+#define BMAP_CACHE 64
+struct
+{
+    int inum;
+    int leaf;
+    unsigned int *ptrs;
+} bmap_cache[BMAP_CACHE];
+
+void *block_addr_to_addr(int block_addr)
+{
+    return (char *)superblock_addr + ((size_t)block_addr << block_shift);
+}
+
+static inline __attribute__((always_inline)) int dir_scan(dir_ent_t *entries, int n, char *name)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (name == NULL ? entries[i].inum == -1 : entries[i].inum != -1 && strcmp(entries[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Directory scans and whole-block copies get the block size as a constant
+// for the sizes mkfs is usually asked for, so each one is unrolled and
+// inlined for it; any other size takes the generic loop.
+
+// index of the entry called `name` in directory block `block_idx`, or of its
+// first free entry if `name` is NULL; -1 if there is none
+int dir_find(int block_idx, char *name)
+{
+    dir_ent_t *entries = (dir_ent_t *)data_block(block_idx);
+    switch (block_size)
+    {
+    case 4096:
+        return dir_scan(entries, 4096 / sizeof(dir_ent_t), name);
+    case 16384:
+        return dir_scan(entries, 16384 / sizeof(dir_ent_t), name);
+    case 65536:
+        return dir_scan(entries, 65536 / sizeof(dir_ent_t), name);
+    default:
+        return dir_scan(entries, block_size / sizeof(dir_ent_t), name);
+    }
+}
+
+void copy_block(int dst_idx, int src_idx)
+{
+    char *dst = data_block(dst_idx);
+    char *src = data_block(src_idx);
+    switch (block_size)
+    {
+    case 4096:
+        memcpy(dst, src, 4096);
+        break;
+    case 16384:
+        memcpy(dst, src, 16384);
+        break;
+    case 65536:
+        memcpy(dst, src, 65536);
+        break;
+    default:
+        memcpy(dst, src, block_size);
+    }
+}
+
+int get_ith_bit(unsigned int *bitmap, int ith)
+{
+    int block_idx = ith / 32;
+    int offset = 31 - (ith % 32);
+    return (bitmap[block_idx] >> offset) & 0x1;
+}
+
+void set_ith_bit(unsigned int *bitmap, int ith, int val)
+{
+    // val should be either 0 or 1.
+    int block_idx = ith / 32;
+    int offset = 31 - (ith % 32);
+    if (val)
+        bitmap[block_idx] |= 0x1 << offset;
+    else
+        bitmap[block_idx] &= ~(0x1 << offset);
+}
+
+int count_free_bits(unsigned int *bitmap, int nbits)
+{
+    int used = 0;
+    for (int i = 0; i < nbits / 32; i++)
+        used += __builtin_popcount(bitmap[i]);
+    for (int i = nbits / 32 * 32; i < nbits; i++)
+        used += get_ith_bit(bitmap, i);
+    return nbits - used;
+}
+
+// first clear bit at or after `start`, or -1; skips full words at a time
+int find_free_bit(unsigned int *bitmap, int nbits, int start)
+{
+    if (start < 0 || start >= nbits)
+        return -1;
+
+    int w = start / 32;
+    unsigned int word = bitmap[w];
+    if (start % 32)
+        word |= ~0u << (32 - start % 32); // bits before start count as used
+    while (word == ~0u)
+    {
+        if (++w * 32 >= nbits)
+            return -1;
+        word = bitmap[w];
+    }
+
+    int i = w * 32 + __builtin_clz(~word); // bit 0 is the word's MSB
+    return i < nbits ? i : -1;
+}
+
+// first clear bit at or after `goal`, wrapping around to the start
+int find_free_near(unsigned int *bitmap, int nbits, int goal)
+{
+    int i = find_free_bit(bitmap, nbits, goal);
+    return i != -1 || goal <= 0 ? i : find_free_bit(bitmap, nbits, 0);
+}
+
+int get_available_inum()
+{
+    return find_free_bit(block_addr_to_addr(superblock_addr->inode_bitmap_addr), superblock_addr->num_inodes, 0);
+}
+
+int get_available_datablock()
+{
+    return find_free_bit(block_addr_to_addr(superblock_addr->data_bitmap_addr), superblock_addr->num_data, 0);
+}
+
+// where allocations for a directory's entries start when nothing else is
+// known: directories are hashed over groups of ALLOC_GROUP blocks
+int alloc_group_start(int dir_inum)
+{
+    int groups = superblock_addr->num_data / ALLOC_GROUP;
+    if (groups <= 1)
+        return 0;
+    return (int)(((unsigned int)dir_inum * 2654435761u) % groups) * ALLOC_GROUP;
+}
+
+// takes a free data block for a single owner, the first one at or after
+// `goal`; returns its index or -1
+int alloc_datablock(int goal)
+{
+    int block_idx = find_free_near(block_addr_to_addr(superblock_addr->data_bitmap_addr), superblock_addr->num_data, goal);
+    if (block_idx == -1)
+        return -1;
+
+    set_ith_bit(block_addr_to_addr(superblock_addr->data_bitmap_addr), block_idx, 1);
+    block_refs[block_idx] = 1;
+    return block_idx;
+}
+
+// start of the first run of `want` free blocks within ALLOC_SEARCH blocks
+// after `goal`, else the first free block there is (or -1)
+int find_free_run(int goal, int want)
+{
+    unsigned int *bitmap = block_addr_to_addr(superblock_addr->data_bitmap_addr);
+    int nbits = superblock_addr->num_data;
+
+    int first = find_free_near(bitmap, nbits, goal);
+    for (int i = first; i != -1 && i - first < ALLOC_SEARCH;)
+    {
+        int len = 1;
+        while (len < want && i + len < nbits && !get_ith_bit(bitmap, i + len))
+            len++;
+        if (len == want)
+            return i;
+        i = find_free_bit(bitmap, nbits, i + len);
+    }
+    return first;
+}
+
+// drops one owner; the block is free once no inode points at it
+void release_datablock(int block_idx)
+{
+    if (block_refs[block_idx] > 0 && --block_refs[block_idx] > 0)
+        return;
+
+    set_ith_bit(block_addr_to_addr(superblock_addr->data_bitmap_addr), block_idx, 0);
+}
+
+// the block of pointers `slot` points at; a missing one is allocated, all
+// holes, if `alloc` (else NULL)
+unsigned int *indirect_block(unsigned int *slot, int alloc, int goal)
+{
+    if (*slot == -1)
+    {
+        int block_idx = alloc ? alloc_datablock(goal) : -1;
+        if (block_idx == -1)
+            return NULL;
+        memset(data_block(block_idx), 0xff, block_size);
+        *slot = block_idx + superblock_addr->data_region_addr;
+    }
+    return (unsigned int *)data_block(*slot - superblock_addr->data_region_addr);
+}
+
+// the pointer to block `i` of `inum`, or NULL past what the format
+// addresses. Indirect blocks on the way are allocated if `alloc`; without
+// it, NULL also means a hole.
+unsigned int *block_slot(int inum, int i, int alloc)
+{
+    inode_t *inode = &inode_area[inum];
+    if (i < 0 || i >= max_file_blocks)
+        return NULL;
+    if (!ext_format || i < EXT_DIRECT_PTRS)
+        return &inode->direct[i];
+
+    i -= EXT_DIRECT_PTRS;
+    if (i < indirect_ptrs)
+    {
+        unsigned int *ptrs = indirect_block(&inode->direct[EXT_SINGLE], alloc, alloc_goal[inum]);
+        return ptrs == NULL ? NULL : &ptrs[i];
+    }
+
+    i -= indirect_ptrs;
+    int leaf = i / indirect_ptrs;
+    int c = inum % BMAP_CACHE;
+    if (bmap_cache[c].inum != inum || bmap_cache[c].leaf != leaf)
+    {
+        unsigned int *leaves = indirect_block(&inode->direct[EXT_DOUBLE], alloc, alloc_goal[inum]);
+        unsigned int *ptrs = leaves == NULL ? NULL : indirect_block(&leaves[leaf], alloc, alloc_goal[inum]);
+        if (ptrs == NULL)
+            return NULL;
+        bmap_cache[c].inum = inum;
+        bmap_cache[c].leaf = leaf;
+        bmap_cache[c].ptrs = ptrs;
+    }
+    return &bmap_cache[c].ptrs[i % indirect_ptrs];
+}
+
+// data block index of block `i` of `inum`, or -1 for a hole
+int file_block(int inum, int i)
+{
+    unsigned int *slot = block_slot(inum, i, 0);
+    return slot == NULL || *slot == -1 ? -1 : *slot - superblock_addr->data_region_addr;
+}
+
+// block `i` of `inum` with this inode as its only owner, copying a shared one
+// first (and allocating a missing one); returns the data block index or -1
+int writable_block(int inum, int i)
+{
+    unsigned int *slot = block_slot(inum, i, 1);
+    if (slot == NULL)
+        return -1;
+    int block_idx = *slot == -1 ? -1 : *slot - superblock_addr->data_region_addr;
+    if (block_idx != -1 && block_refs[block_idx] <= 1)
+        return block_idx;
+
+    // next to the file's other blocks, so it stays contiguous where it can
+    int goal = block_idx;
+    int prev_idx = i > 0 ? file_block(inum, i - 1) : -1;
+    if (prev_idx != -1)
+        goal = prev_idx + 1;
+    else if (goal == -1)
+        goal = alloc_goal[inum];
+    int new_idx = alloc_datablock(goal);
+    if (new_idx == -1)
+        return -1;
+    if (block_idx != -1)
+    {
+        copy_block(new_idx, block_idx);
+        release_datablock(block_idx);
+    }
+    *slot = new_idx + superblock_addr->data_region_addr;
+    alloc_goal[inum] = new_idx + 1;
+    return new_idx;
+}
+
+// releases the block `slot` points at and, `depth` levels of pointers down,
+// the blocks it points at
+void release_tree(unsigned int *slot, int depth)
+{
+    if (*slot == -1)
+        return;
+
+    int block_idx = *slot - superblock_addr->data_region_addr;
+    if (depth > 0)
+    {
+        unsigned int *ptrs = (unsigned int *)data_block(block_idx);
+        for (int k = 0; k < indirect_ptrs; k++)
+            release_tree(&ptrs[k], depth - 1);
+    }
+    release_datablock(block_idx);
+    *slot = -1;
+}
+
+// every block of `inum`, indirect blocks included
+void release_file_blocks(int inum)
+{
+    inode_t *inode = &inode_area[inum];
+    for (int j = 0; j < (ext_format ? EXT_DIRECT_PTRS : DIRECT_PTRS); j++)
+        release_tree(&inode->direct[j], 0);
+    if (ext_format)
+    {
+        release_tree(&inode->direct[EXT_SINGLE], 1);
+        release_tree(&inode->direct[EXT_DOUBLE], 2);
+        bmap_cache[inum % BMAP_CACHE].inum = -1;
+    }
+}
+
+int server_lookup(int pinum, char *name)
+{
+    if (pinum < 0 || pinum >= superblock_addr->num_inodes)
+        return -1;
+
+    if (inode_area[pinum].type != MFS_DIRECTORY)
+        return -1;
+
+    for (int i = 0; i < DIRECT_PTRS; i++)
+    {
+        if (inode_area[pinum].direct[i] == -1)
+            continue;
+
+        int block_idx = inode_area[pinum].direct[i] - superblock_addr->data_region_addr;
+        int j = dir_find(block_idx, name);
+        if (j != -1)
+            return ((dir_ent_t *)data_block(block_idx))[j].inum;
+    }
+    return -1;
+}
+
+inode_t server_stat(int inum)
+{
+    if (inum < 0 || inum >= superblock_addr->num_inodes)
+        return empty_inode;
+
+    return inode_area[inum];
+}
+
+// where in its block the byte at `offset` is. Images with blocks larger than
+// MFS_BLOCK_SIZE take transfers starting anywhere within a block; 4K images
+// keep starting at the block.
+int block_offset(int offset)
+{
+    return block_size > UFS_BLOCK_SIZE ? offset & (block_size - 1) : 0;
+}
+
+int server_write(int inum, char *buffer, int offset, int nbytes)
+{
+    if (nbytes < 0 || offset < 0 || offset >> block_shift >= max_file_blocks || block_offset(offset) + nbytes > block_size)
+        return -1;
+
+    if (inum < 0 || inum >= superblock_addr->num_inodes)
+        return -1;
+
+    if (inode_area[inum].type == MFS_DIRECTORY)
+        return -1;
+
+    // classic files get all their blocks at creation; extended ones on first write
+    if (!ext_format && inode_area[inum].direct[offset >> block_shift] == -1) // no data block left at creation
+        return -1;
+
+    int block_idx = writable_block(inum, offset >> block_shift); // copy-on-write if cloned
+    if (block_idx == -1)
+        return -1;
+    memcpy(data_block(block_idx) + block_offset(offset), buffer, nbytes);
+
+    // the end of the furthest write, so rewriting a block does not grow the file
+    long long end = (long long)offset + nbytes;
+    if (end > inode_area[inum].size)
+        inode_area[inum].size = end < INT_MAX ? end : INT_MAX;
+    return 0;
+}
+
+int server_read(int inum, char *buffer, int offset, int nbytes)
+{
+    if (nbytes < 0 || offset < 0 || offset >> block_shift >= max_file_blocks || block_offset(offset) + nbytes > block_size)
+        return -1;
+
+    if (inum < 0 || inum >= superblock_addr->num_inodes)
+        return -1;
+
+    int block_idx = file_block(inum, offset >> block_shift);
+    if (block_idx == -1)
+    {
+        if (!ext_format || inode_area[inum].type != MFS_REGULAR_FILE)
+            return -1;
+        memset(buffer, 0, nbytes); // never written
+        return 0;
+    }
+    memcpy(buffer, data_block(block_idx) + block_offset(offset), nbytes);
+    return 0;
+}
+
+int server_create(int pinum, int type, char *name)
+{
+    if (strlen(name) > 28)
+    {
+        LOG(TRACE_ERROR, "server:: invalid name, creating failed.\n");
+        return -1;
+    }
+
+    if (pinum < 0 || pinum >= superblock_addr->num_inodes)
+        return -1;
+
+    if (inode_area[pinum].type != MFS_DIRECTORY)
+    {
+        LOG(TRACE_ERROR, "server:: parent type != MFS_DIRECTORY, creating failed.\n");
+        return -1;
+    }
+
+    if (server_lookup(pinum, name) != -1) // already exists
+        return 0;
+
+    int block_idx = inode_area[pinum].direct[0] - superblock_addr->data_region_addr;
+    int entry_idx = dir_find(block_idx, NULL);
+    if (entry_idx == -1) // parent dir is full
+        return -1;
+
+    int next_inum = get_available_inum();
+    LOG(TRACE_DEBUG, "server:: next inum: %d\n", next_inum);
+    if (next_inum == -1)
+        return -1;
+
+    if (type == MFS_DIRECTORY) // new directory
+    {
+        // get 1 datablock, in the new directory's own group
+        int next_datablock = alloc_datablock(alloc_group_start(next_inum));
+        if (next_datablock == -1)
+            return -1;
+
+        dir_ent_t *entries = (dir_ent_t *)data_block(next_datablock);
+        strcpy(entries[0].name, "."); // current dir
+        entries[0].inum = next_inum;
+        strcpy(entries[1].name, ".."); // parent dir
+        entries[1].inum = pinum;
+
+        for (int i = 1; i < DIRECT_PTRS; i++)
+        {
+            inode_area[next_inum].direct[i] = -1; // unused
+        }
+        for (int i = 2; i < block_size / sizeof(dir_ent_t); i++)
+        {
+            entries[i].name[0] = '\0';
+            entries[i].inum = -1; // unused
+        }
+
+        inode_area[next_inum].direct[0] = next_datablock + superblock_addr->data_region_addr;
+        inode_area[next_inum].size = 2 * sizeof(dir_ent_t);
+    }
+    else if (ext_format) // new file, blocks allocated as it is written
+    {
+        if (alloc_goal[pinum] == -1)
+            alloc_goal[pinum] = alloc_group_start(pinum);
+        for (int i = 0; i < DIRECT_PTRS; i++)
+            inode_area[next_inum].direct[i] = -1;
+        alloc_goal[next_inum] = alloc_goal[pinum];
+        inode_area[next_inum].size = 0;
+    }
+    else // new file
+    {
+        // one run for the whole file where possible, after the blocks last
+        // given to this directory's files
+        if (alloc_goal[pinum] == -1)
+            alloc_goal[pinum] = alloc_group_start(pinum);
+        int goal = find_free_run(alloc_goal[pinum], DIRECT_PTRS);
+
+        for (int i = 0; i < DIRECT_PTRS; i++)
+        {
+            // best effort: blocks left unallocated (-1) once the data region is full
+            int next_datablock = alloc_datablock(goal);
+            if (next_datablock == -1)
+            {
+                inode_area[next_inum].direct[i] = -1;
+                continue;
+            }
+            inode_area[next_inum].direct[i] = next_datablock + superblock_addr->data_region_addr;
+            goal = next_datablock + 1;
+        }
+        if (goal != -1)
+            alloc_goal[pinum] = goal;
+        inode_area[next_inum].size = 0;
+    }
+    inode_area[next_inum].type = type;
+
+    LOG(TRACE_DEBUG, "server:: block %d's inum is written to %d\n", entry_idx, next_inum);
+
+    // data block setup
+    dir_ent_t *entry = (dir_ent_t *)data_block(block_idx) + entry_idx;
+    entry->inum = next_inum;
+    strcpy(entry->name, name);
+
+    set_ith_bit(block_addr_to_addr(superblock_addr->inode_bitmap_addr), next_inum, 1);
+    inode_area[pinum].size += sizeof(dir_ent_t);
+    return 0;
+}
+
+int server_unlink(int pinum, char *name)
+{
+    if (pinum < 0 || pinum >= superblock_addr->num_inodes)
+        return -1;
+
+    if (inode_area[pinum].type == MFS_REGULAR_FILE)
+        return -1;
+
+    int block_idx = inode_area[pinum].direct[0] - superblock_addr->data_region_addr;
+    int i = dir_find(block_idx, name);
+    if (i == -1)
+        return 0;
+
+    dir_ent_t *entry = (dir_ent_t *)data_block(block_idx) + i;
+    int target_inum = entry->inum;
+
+    // dir is not empty
+    if (inode_area[target_inum].type == MFS_DIRECTORY &&
+        inode_area[target_inum].size > 2 * sizeof(dir_ent_t))
+        return -1;
+
+    // release the data blocks and the inode itself
+    release_file_blocks(target_inum);
+    set_ith_bit(block_addr_to_addr(superblock_addr->inode_bitmap_addr), target_inum, 0);
+
+    inode_area[target_inum].size = 0;
+    inode_area[target_inum].type = 0;
+
+    entry->inum = -1;
+    strcpy(entry->name, "\0");
+
+    inode_area[pinum].size -= sizeof(dir_ent_t);
+    return 0;
+}
+
+// bytes of `inum` backed by its blocks: the size, cut back to the end of the
+// last block mapped below it, since a size can run past the file's data
+int mapped_size(int inum)
+{
+    long long size = inode_area[inum].size;
+    if (size > (long long)max_file_blocks * block_size)
+        size = (long long)max_file_blocks * block_size;
+
+    int i = (size - 1) >> block_shift;
+    while (i >= 0 && file_block(inum, i) == -1)
+        i--;
+    long long extent = (long long)(i + 1) * block_size;
+    return size < extent ? size : extent;
+}
+
+// Copies bytes [offset, offset + len) of `src_inum` into `dst_inum` at the
+// same offset, within the server. With `clone`, blocks the range covers
+// entirely (or up to the end of the source) are shared instead, and copied
+// only on the next write to either file. Fails without changing anything if
+// the blocks it needs are not there.
+int server_copy(int src_inum, int dst_inum, int offset, int len, int clone)
+{
+    if (src_inum < 0 || src_inum >= superblock_addr->num_inodes ||
+        dst_inum < 0 || dst_inum >= superblock_addr->num_inodes || offset < 0 || len < 0)
+        return -1;
+
+    inode_t *src = &inode_area[src_inum];
+    inode_t *dst = &inode_area[dst_inum];
+    if (src->type != MFS_REGULAR_FILE || dst->type != MFS_REGULAR_FILE)
+        return -1;
+
+    // only the mapped data is copied, however large the source's size says it is
+    int src_size = mapped_size(src_inum);
+    int end = (long long)offset + len < src_size ? offset + len : src_size;
+    if (src_inum == dst_inum || end <= offset)
+        return 0;
+
+    // first pass: check every block is there (extended files may have holes)
+    // and count the ones to allocate, indirect blocks included
+    int first = offset >> block_shift;
+    int last = (end - 1) >> block_shift;
+    int needed = 0;
+    int leaf = -1;
+    for (int i = first; i <= last; i++)
+    {
+        int src_idx = file_block(src_inum, i);
+        int dst_idx = file_block(dst_inum, i);
+        if (src_idx == -1 && !ext_format)
+            return -1;
+
+        if (ext_format && i >= EXT_DIRECT_PTRS && block_slot(dst_inum, i, 0) == NULL)
+        {
+            int l = i < EXT_DIRECT_PTRS + indirect_ptrs ? 0 : 1 + (i - EXT_DIRECT_PTRS - indirect_ptrs) / indirect_ptrs;
+            if (l != leaf)
+                needed += l > 0 && dst->direct[EXT_DOUBLE] == -1 ? 2 : 1; // at most
+            leaf = l;
+        }
+
+        int whole = offset <= (long long)i * block_size && ((long long)(i + 1) * block_size <= end || (end == src_size && dst->size <= end));
+        if ((clone && whole) || (src_idx == -1 && dst_idx == -1))
+            continue;
+        if (dst_idx == -1 || block_refs[dst_idx] > 1)
+            needed++;
+    }
+    if (needed > count_free_bits(block_addr_to_addr(superblock_addr->data_bitmap_addr), superblock_addr->num_data))
+        return -1;
+
+    for (int i = first; i <= last; i++)
+    {
+        int src_idx = file_block(src_inum, i);
+        int whole = offset <= (long long)i * block_size && ((long long)(i + 1) * block_size <= end || (end == src_size && dst->size <= end));
+        if (clone && whole)
+        {
+            unsigned int ptr = src_idx == -1 ? -1 : src_idx + superblock_addr->data_region_addr;
+            unsigned int *slot = block_slot(dst_inum, i, src_idx != -1);
+            if (slot == NULL || *slot == ptr)
+                continue;
+            if (*slot != -1)
+                release_datablock(*slot - superblock_addr->data_region_addr);
+            *slot = ptr;
+            if (src_idx != -1)
+                block_refs[src_idx]++;
+            continue;
+        }
+
+        int from = i == first ? offset & (block_size - 1) : 0;
+        int to = i == last ? end - (i << block_shift) : block_size;
+        if (src_idx == -1 && file_block(dst_inum, i) == -1)
+            continue; // a hole onto a hole
+        int dst_idx = writable_block(dst_inum, i);
+        if (dst_idx == -1)
+            return -1;
+        if (src_idx == -1)
+            memset(data_block(dst_idx) + from, 0, to - from);
+        else
+            memcpy(data_block(dst_idx) + from, data_block(src_idx) + from, to - from);
+    }
+
+    if (dst->size < end)
+        dst->size = end;
+    LOG(TRACE_DEBUG, "server:: %s %d -> %d [%d, %d)\n", clone ? "clone" : "copy", src_inum, dst_inum, offset, end);
+    return 0;
+}
+
+// one more owner for the block `ptr` points at and, `depth` levels of
+// pointers down, for the blocks it points at
+void count_refs(unsigned int ptr, int depth)
+{
+    int block_idx = ptr - superblock_addr->data_region_addr;
+    if (ptr == -1 || block_idx < 0 || block_idx >= superblock_addr->num_data)
+        return;
+
+    block_refs[block_idx]++;
+    if (depth > 0)
+    {
+        unsigned int *ptrs = (unsigned int *)data_block(block_idx);
+        for (int k = 0; k < indirect_ptrs; k++)
+            count_refs(ptrs[k], depth - 1);
+    }
+}
+
+// allocator state is not on disk: block_refs is rebuilt from the inodes in
+// use, and directory goals start out unknown
+void build_alloc_state()
+{
+    block_refs = calloc(superblock_addr->num_data, sizeof(unsigned int));
+    alloc_goal = malloc(superblock_addr->num_inodes * sizeof(int));
+    for (int i = 0; i < superblock_addr->num_inodes; i++)
+        alloc_goal[i] = -1;
+    for (int i = 0; i < superblock_addr->num_inodes; i++)
+    {
+        if (!get_ith_bit(block_addr_to_addr(superblock_addr->inode_bitmap_addr), i))
+            continue;
+
+        for (int j = 0; j < (ext_format ? EXT_DIRECT_PTRS : DIRECT_PTRS); j++)
+            count_refs(inode_area[i].direct[j], 0);
+        if (ext_format)
+        {
+            count_refs(inode_area[i].direct[EXT_SINGLE], 1);
+            count_refs(inode_area[i].direct[EXT_DOUBLE], 2);
+        }
+    }
+    for (int c = 0; c < BMAP_CACHE; c++)
+        bmap_cache[c].inum = -1;
+}
+
+// all of `len` bytes at `off`; the kernel may take a run in pieces
+int write_run(void *buf, size_t len, off_t off)
+{
+    for (size_t done = 0; done < len;)
+    {
+        ssize_t rc = pwrite(server_img_fd, (char *)buf + done, len - done, off + done);
+        if (rc <= 0)
+            return -1;
+        done += rc;
+    }
+    return 0;
+}
+
+// each region goes out as one run of pwrites; returns -1 if any failed. Safe
+// to call in a forked child: it neither allocates nor moves the file offset.
+int save_server_file()
+{
+    unsigned long long start_ns = trace_now_ns();
+    int rc = 0;
+
+    rc |= write_run(block_addr_to_addr(superblock_addr->inode_bitmap_addr),
+                    (size_t)superblock_addr->inode_bitmap_len * block_size,
+                    (off_t)superblock_addr->inode_bitmap_addr * block_size);
+    LOG(TRACE_DEBUG, "server:: inode bitmap saved\n");
+
+    rc |= write_run(block_addr_to_addr(superblock_addr->data_bitmap_addr),
+                    (size_t)superblock_addr->data_bitmap_len * block_size,
+                    (off_t)superblock_addr->data_bitmap_addr * block_size);
+    LOG(TRACE_DEBUG, "server:: data bitmap saved\n");
+
+    rc |= write_run(inode_area, (size_t)superblock_addr->num_inodes * sizeof(inode_t),
+                    (off_t)superblock_addr->inode_region_addr * block_size);
+    LOG(TRACE_DEBUG, "server:: inode blocks saved\n");
+
+    rc |= write_run(data_area, (size_t)superblock_addr->num_data * block_size,
+                    (off_t)superblock_addr->data_region_addr * block_size);
+    LOG(TRACE_DEBUG, "server:: data blocks saved\n");
+
+    rc |= fsync(server_img_fd);
+    LOG(TRACE_DEBUG, "server:: fsync completed\n");
+    TRACE(TRACE_INFO, TRACE_SAVE, 0, 0, rc, superblock_addr->num_data, trace_now_ns() - start_ns);
+    return rc < 0 ? -1 : 0;
+}
+
+int server_load_image(char *fs_img)
+{
+    empty_inode.type = -1;
+
+    server_img_fd = open(fs_img, O_RDWR, S_IRWXU | S_IRUSR);
+    if (server_img_fd < 0)
+        return -1;
+
+    struct stat server_img_stat;
+    assert(fstat(server_img_fd, &server_img_stat) >= 0); // get stat info of the server file image
+    server_file_size = server_img_stat.st_size;
+
+    server_file = mmap(NULL, server_file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, server_img_fd, 0);
+    assert(server_file != MAP_FAILED);
+    superblock_addr = (super_t *)server_file;
+    int features = superblock_addr->magic == UFS_MAGIC ? superblock_addr->features : 0;
+    if (features & ~(UFS_FEATURE_INDIRECT | UFS_FEATURE_BLOCK_SIZE))
+        return -1; // made by a newer mkfs
+    block_size = features & UFS_FEATURE_BLOCK_SIZE ? superblock_addr->block_size : UFS_BLOCK_SIZE;
+    if (block_size < UFS_BLOCK_SIZE || block_size > UFS_MAX_BLOCK_SIZE || (block_size & (block_size - 1)))
+        return -1;
+    block_shift = __builtin_ctz(block_size);
+    indirect_ptrs = INDIRECT_PTRS(block_size);
+    ext_format = (features & UFS_FEATURE_INDIRECT) != 0;
+    max_file_blocks = ext_format ? EXT_MAX_BLOCKS(block_size) : DIRECT_PTRS;
+
+    data_area = malloc((size_t)block_size * superblock_addr->num_data);
+    inode_area = malloc((size_t)block_size * superblock_addr->inode_region_len);
+
+    // load data to `data_area`
+    for (int i = 0; i < superblock_addr->num_data; i++)
+    {
+        lseek(server_img_fd, ((off_t)i + superblock_addr->data_region_addr) * block_size, SEEK_SET);
+        read(server_img_fd, data_block(i), block_size);
+    }
+
+    // load inodes to `inode_area`
+    for (int i = 0; i < superblock_addr->num_inodes; i++)
+    {
+        lseek(server_img_fd, (off_t)i * sizeof(inode_t) + (off_t)superblock_addr->inode_region_addr * block_size, SEEK_SET);
+        read(server_img_fd, &inode_area[i], sizeof(inode_t));
+    }
+
+    build_alloc_state();
+    return 0;
+}
+
+void server_close_image()
+{
+    free(data_area);
+    free(inode_area);
+    free(block_refs);
+    free(alloc_goal);
+    munmap(server_file, server_file_size);
+    close(server_img_fd);
+}
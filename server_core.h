@@ -0,0 +1,53 @@
+#ifndef __SERVER_CORE_h__
+#define __SERVER_CORE_h__
+
+#include <stddef.h>
+
+#include "ufs.h"
+
+#define ALLOC_GROUP 2048  // data blocks per directory allocation group
+#define ALLOC_SEARCH 8192 // blocks scanned for a file-sized free run
+
+// in-memory image, shared by the UDP server and the benchmarks
+extern inode_t empty_inode;
+extern int server_img_fd;
+extern int *server_file;
+extern super_t *superblock_addr;
+extern inode_t *inode_area;
+extern char *data_area;
+extern unsigned int *block_refs; // inodes pointing at each data block; >1 once cloned
+extern int ext_format;           // indirect blocks (mkfs -x)
+extern int max_file_blocks;
+extern int block_size;           // the image's (mkfs -b), a power of two
+extern int block_shift;          // log2(block_size)
+
+// data block `block_idx` in `data_area`
+static inline char *data_block(int block_idx)
+{
+    return data_area + ((size_t)block_idx << block_shift);
+}
+
+int server_load_image(char *fs_img);
+void server_close_image();
+
+void *block_addr_to_addr(int block_addr);
+int get_ith_bit(unsigned int *bitmap, int ith);
+void set_ith_bit(unsigned int *bitmap, int ith, int val);
+int count_free_bits(unsigned int *bitmap, int nbits);
+int get_available_inum();
+int find_free_bit(unsigned int *bitmap, int nbits, int start);
+int get_available_datablock();
+int alloc_datablock(int goal);
+void release_datablock(int block_idx);
+
+int server_lookup(int pinum, char *name);
+inode_t server_stat(int inum);
+int server_write(int inum, char *buffer, int offset, int nbytes);
+int server_read(int inum, char *buffer, int offset, int nbytes);
+int server_create(int pinum, int type, char *name);
+int server_unlink(int pinum, char *name);
+int mapped_size(int inum);
+int server_copy(int src_inum, int dst_inum, int offset, int len, int clone);
+int save_server_file();
+
+#endif // __SERVER_CORE_h__
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "shm.h"
+#include "trace.h"
+
+typedef struct
+{
+    shm_ring_t *ring;
+    int (*serve)(MSG_t *, MSG_t *);
+    void (*shutdown)();
+} shm_session_t;
+
+int client_alive(int pid)
+{
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+void *shm_session(void *arg)
+{
+    shm_session_t *session = arg;
+    shm_ring_t *ring = session->ring;
+    unsigned int next = __atomic_load_n(&ring->resp_head, __ATOMIC_ACQUIRE);
+
+    // sessions come and go with their clients; a ring apiece would pile up
+    trace_share_ring();
+
+    while (1)
+    {
+        if (shm_wait_change(&ring->req_head, next) < 0)
+        {
+            if (!client_alive(ring->client_pid))
+                break;
+            continue;
+        }
+
+        // the request and reply stay in the shared slots; nothing is copied
+        MSG_t *request = &ring->req[next % SHM_SLOTS];
+        MSG_t *response = &ring->resp[next % SHM_SLOTS];
+        int shutdown = session->serve(request, response);
+
+        __atomic_store_n(&ring->resp_head, ++next, __ATOMIC_RELEASE);
+        futex_wake(&ring->resp_head);
+
+        if (shutdown)
+            session->shutdown();
+    }
+
+    LOG(TRACE_DEBUG, "server:: shm client %d is gone\n", ring->client_pid);
+    munmap(ring, sizeof(shm_ring_t));
+    free(session);
+    return NULL;
+}
+
+int shm_attach(MSG_t *request, int (*serve)(MSG_t *, MSG_t *), void (*shutdown)())
+{
+    // only a client on this host can name one of its descriptors here
+    char hostname[sizeof(request->name)];
+    gethostname(hostname, sizeof(hostname));
+    hostname[sizeof(hostname) - 1] = '\0';
+    if (strncmp(hostname, request->name, sizeof(hostname) - 1) != 0)
+        return -1;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", request->inum, request->offset);
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return -1;
+
+    shm_ring_t *ring = mmap(NULL, sizeof(shm_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED)
+        return -1;
+
+    if (ring->client_pid != request->inum || ring->token != request->nbytes)
+    {
+        munmap(ring, sizeof(shm_ring_t));
+        return -1;
+    }
+    if (ring->server_pid == getpid())
+    {
+        munmap(ring, sizeof(shm_ring_t));
+        return 0; // resent attach whose reply was lost; already served
+    }
+    ring->server_pid = getpid();
+
+    shm_session_t *session = malloc(sizeof(shm_session_t));
+    session->ring = ring;
+    session->serve = serve;
+    session->shutdown = shutdown;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, shm_session, session) != 0)
+    {
+        munmap(ring, sizeof(shm_ring_t));
+        free(session);
+        return -1;
+    }
+    pthread_detach(tid);
+    LOG(TRACE_DEBUG, "server:: shm client %d attached\n", request->inum);
+    return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef __SHM_h__
+#define __SHM_h__
+
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "msg.h"
+
+#define SHM_SLOTS (8)
+#define SHM_WAIT_MS (1000) // how often a waiting side checks its peer is alive
+#define SHM_SPIN (2000)     // polls of the other side's counter before sleeping
+
+// Shared request/reply rings for a client on the server's host. The client
+// creates the memfd and the server maps it through /proc/<pid>/fd/<fd>.
+// Each side only writes its own head counter, then wakes the futex on it.
+typedef struct {
+    unsigned int req_head;  // requests published by the client
+    unsigned int resp_head; // replies published by the server
+    int server_pid;
+    int client_pid;
+    int token; // random, echoed in SHM_ATTACH_t so a stray fd is never mapped
+    MSG_t req[SHM_SLOTS];
+    MSG_t resp[SHM_SLOTS];
+} shm_ring_t;
+
+static inline void futex_wait(unsigned int *addr, unsigned int val, int timeout_ms)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static inline void futex_wake(unsigned int *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// spin briefly (only if the other side can run meanwhile), then sleep until
+// *addr != val; returns 0 once it changed and -1 if it did not for SHM_WAIT_MS
+static inline int shm_wait_change(unsigned int *addr, unsigned int val)
+{
+    static int spin = -1;
+    if (spin < 0)
+        spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0;
+
+    for (int i = 0; i < spin; i++)
+    {
+        if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != val)
+            return 0;
+    }
+    futex_wait(addr, val, SHM_WAIT_MS);
+    return __atomic_load_n(addr, __ATOMIC_ACQUIRE) != val ? 0 : -1;
+}
+
+// client side: set up a ring and ask the server (over UDP) to attach to it
+// server side: map the client's ring named in a SHM_ATTACH_t request and
+// serve it from a new thread. `serve` handles one request and returns 1 when
+// `shutdown` must run once the reply has been published.
+int shm_attach(MSG_t *request, int (*serve)(MSG_t *, MSG_t *), void (*shutdown)());
+
+#endif // __SHM_h__
@@ -0,0 +1,64 @@
+#ifndef __STATS_h__
+#define __STATS_h__
+
+#define STATS_OPS (16)          // counters are indexed by msg_type
+#define STATS_HIST_BUCKETS (48) // log-linear latency buckets, in microseconds
+
+typedef struct __MFS_Stats_t {
+    unsigned long long uptime_us;
+    unsigned long long ops[STATS_OPS];
+    unsigned long long errors[STATS_OPS];      // replies with rc < 0
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long duplicates;             // same client and seq seen twice
+    unsigned long long retransmits;            // requests the client marked as resent
+    unsigned long long bad_requests;           // unknown msg_type
+    unsigned long long repl_forwarded;         // mutations acked by the backups
+    unsigned long long repl_rejected_hellos;   // REPL_HELLOs from hosts that are not a primary
+    unsigned long long payload_raw;            // READ/WRITE data bytes, uncompressed
+    unsigned long long payload_wire;           // the same bytes as sent or received
+    unsigned long long compressed;             // payloads that crossed compressed
+    unsigned long long compress_skipped;       // not tried: compression was not paying
+    unsigned long long busy;                   // requests turned away with MSG_BUSY
+    unsigned long long checkpoints;            // background snapshots written
+    unsigned long long checkpoint_failures;
+    unsigned long long dirty_bytes;            // changed since the last snapshot
+    unsigned int checkpoint_pause_us;          // fork() of the last one
+    unsigned int checkpoint_max_pause_us;
+    unsigned int checkpoint_ms;                // the last one, fork to fsync
+    int repl_backups;                          // live backups
+    int watches;                               // live directory watches
+    int queued;                                // UDP requests waiting for the scheduler
+    int num_inodes;
+    int free_inodes;
+    int num_data;
+    int free_data;
+    int block_size;                            // of the image, in bytes
+    unsigned int latency[STATS_OPS][STATS_HIST_BUCKETS];
+} MFS_Stats_t;
+
+// HDR-style bucketing: exact below 4us, then two sub-buckets per power of two,
+// so every bucket is within 50% of its lower bound. The last bucket is ~16s+.
+static inline int stats_bucket(unsigned long long us)
+{
+    if (us < 4)
+        return (int)us;
+
+    int msb = 63 - __builtin_clzll(us);
+    int bucket = 4 + (msb - 2) * 2 + (int)((us >> (msb - 1)) & 0x1);
+    return bucket < STATS_HIST_BUCKETS ? bucket : STATS_HIST_BUCKETS - 1;
+}
+
+// smallest latency (us) that lands in `bucket`
+static inline unsigned long long stats_bucket_low(int bucket)
+{
+    if (bucket < 4)
+        return bucket;
+
+    int msb = 2 + (bucket - 4) / 2;
+    return (1ULL << msb) | ((unsigned long long)((bucket - 4) % 2) << (msb - 1));
+}
+
+int MFS_Stats(MFS_Stats_t *s);
+
+#endif // __STATS_h__
@@ -0,0 +1,144 @@
+#include <netinet/tcp.h>
+
+#include "stream.h"
+
+int STREAM_Listen_TCP(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0)
+    {
+        perror("stream listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int STREAM_Listen_Unix(char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path); // left behind by a server that did not shut down
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0)
+    {
+        perror("stream listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int STREAM_Connect_TCP(char *hostname, int port)
+{
+    struct sockaddr_in addr;
+    if (UDP_FillSockAddr(&addr, hostname, port) < 0)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    int one = 1; // requests are small and each one waits for its reply
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+int STREAM_Connect_Unix(char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int STREAM_Frame(char *frame, MSG_t *msg, int n)
+{
+    uint32_t len = htonl(n);
+    memcpy(frame, &len, 4);
+    memcpy(frame + 4, msg, n);
+    return 4 + n;
+}
+
+int write_full(int fd, char *buf, int n)
+{
+    for (int done = 0; done < n;)
+    {
+        int rc = send(fd, buf + done, n - done, MSG_NOSIGNAL);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        done += rc;
+    }
+    return n;
+}
+
+int read_full(int fd, char *buf, int n)
+{
+    for (int done = 0; done < n;)
+    {
+        int rc = recv(fd, buf + done, n - done, 0);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        done += rc;
+    }
+    return n;
+}
+
+int STREAM_WriteMsg(int fd, MSG_t *msg, int n)
+{
+    char frame[STREAM_FRAME_MAX];
+    return write_full(fd, frame, STREAM_Frame(frame, msg, n));
+}
+
+int STREAM_ReadMsg(int fd, MSG_t *msg)
+{
+    uint32_t len;
+    if (read_full(fd, (char *)&len, 4) < 0)
+        return -1;
+
+    len = ntohl(len);
+    if (len < MSG_HEADER_SIZE || len > sizeof(MSG_t))
+        return -1;
+    return read_full(fd, (char *)msg, len);
+}
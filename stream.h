@@ -0,0 +1,27 @@
+#ifndef __STREAM_h__
+#define __STREAM_h__
+
+#include <sys/un.h>
+
+#include "udp.h"
+#include "msg.h"
+
+// Stream transport (TCP or AF_UNIX): every message is a frame of a 4-byte
+// length in network order followed by that many leading bytes of an MSG_t,
+// so only the header and the payload that is used cross the socket.
+
+#define STREAM_FRAME_MAX (4 + (int)sizeof(MSG_t))
+
+int STREAM_Listen_TCP(int port);
+int STREAM_Listen_Unix(char *path);
+int STREAM_Connect_TCP(char *hostname, int port);
+int STREAM_Connect_Unix(char *path);
+
+// build the frame for the first `n` bytes of `msg` in `frame`; returns its size
+int STREAM_Frame(char *frame, MSG_t *msg, int n);
+
+// blocking; both return -1 if the connection is gone or the frame is bad
+int STREAM_WriteMsg(int fd, MSG_t *msg, int n);
+int STREAM_ReadMsg(int fd, MSG_t *msg);
+
+#endif // __STREAM_h__
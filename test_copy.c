@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "mfs.h"
+#include "server_core.h"
+
+char *mkfs_path = "./mkfs";
+int failures;
+
+#define CHECK(cond)                                                            \
+    do                                                                         \
+    {                                                                          \
+        if (!(cond))                                                           \
+        {                                                                      \
+            fprintf(stderr, "test_copy: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+// a fresh image at `path`; `ext` and `bs` as mkfs -x and -b
+int make_image(char *path, int ext, int bs)
+{
+    char bs_arg[16];
+    sprintf(bs_arg, "%d", bs);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        if (ext)
+            execl(mkfs_path, mkfs_path, "-f", path, "-d", "256", "-b", bs_arg, "-x", (char *)NULL);
+        else
+            execl(mkfs_path, mkfs_path, "-f", path, "-d", "256", "-b", bs_arg, (char *)NULL);
+        perror("execl");
+        _exit(1);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int free_blocks()
+{
+    return count_free_bits(block_addr_to_addr(superblock_addr->data_bitmap_addr), superblock_addr->num_data);
+}
+
+// a file whose first block was written over and over, then copied (or cloned)
+// whole: only the data in that block may be carried over
+void test_copy_after_overwrite(int ext, int bs, int clone)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mfs-test-copy-%d.img", getpid());
+    if (make_image(path, ext, bs) < 0 || server_load_image(path) != 0)
+    {
+        fprintf(stderr, "test_copy: no %d-byte image\n", bs);
+        failures++;
+        return;
+    }
+
+    int rc = server_create(0, MFS_REGULAR_FILE, "src");
+    CHECK(rc == 0);
+    rc = server_create(0, MFS_REGULAR_FILE, "dst");
+    CHECK(rc == 0);
+    int src = server_lookup(0, "src");
+    int dst = server_lookup(0, "dst");
+
+    char *block = malloc(bs);
+    char *back = malloc(bs);
+    for (int pass = 0; pass < 40; pass++)
+    {
+        for (int i = 0; i < bs; i++)
+            block[i] = (char)(pass + i * 7);
+        rc = server_write(src, block, 0, bs);
+        CHECK(rc == 0);
+    }
+    CHECK(server_stat(src).size == bs); // rewrites do not grow the file
+    int extent = mapped_size(src);
+    CHECK(extent == bs);
+
+    int before = free_blocks();
+    rc = server_copy(src, dst, 0, 1 << 30, clone);
+    CHECK(rc == 0);
+    CHECK(server_stat(dst).size == extent);
+    if (ext)
+        CHECK(before - free_blocks() == (clone ? 0 : 1));
+
+    rc = server_read(dst, back, 0, bs);
+    CHECK(rc == 0);
+    CHECK(memcmp(back, block, bs) == 0);
+
+    free(block);
+    free(back);
+    server_close_image();
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        mkfs_path = argv[1];
+
+    test_copy_after_overwrite(0, 4096, 0);
+    test_copy_after_overwrite(1, 4096, 0);
+    test_copy_after_overwrite(1, 4096, 1);
+    test_copy_after_overwrite(1, 65536, 0);
+    test_copy_after_overwrite(1, 65536, 1);
+
+    printf("test_copy: %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures != 0;
+}
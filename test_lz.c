@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define MAX_INPUT (65536)
+#define WORST(n) ((n) + (n) / 128 + 1) // every byte a literal
+
+int failures;
+
+#define CHECK(cond)                                                          \
+    do                                                                       \
+    {                                                                        \
+        if (!(cond))                                                         \
+        {                                                                    \
+            fprintf(stderr, "test_lz: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+char in[MAX_INPUT];
+char packed[WORST(MAX_INPUT)];
+char out[MAX_INPUT];
+MSG_t msg;
+
+// compresses and decompresses in[0, n); returns the compressed size
+int round_trip(int n)
+{
+    int zbytes = lz_compress(in, n, packed, WORST(n));
+    CHECK(zbytes >= 0 && zbytes <= WORST(n));
+    if (zbytes < 0)
+        return -1;
+
+    memset(out, 0x5a, sizeof(out));
+    CHECK(lz_decompress(packed, zbytes, out, n) == n);
+    CHECK(memcmp(in, out, n) == 0);
+    // one byte short of room is an overflow, not a short result
+    if (n > 0)
+        CHECK(lz_decompress(packed, zbytes, out, n - 1) == -1);
+    return zbytes;
+}
+
+void fill_text(int n)
+{
+    const char *words[] = {"inode ", "block ", "bitmap ", "directory ", "checkpoint ", "replica "};
+    for (int i = 0; i < n; i++)
+        in[i] = words[(i / 11) % 6][i % 7];
+}
+
+void fill_random(int n)
+{
+    for (int i = 0; i < n; i++)
+        in[i] = rand();
+}
+
+void test_zero_runs()
+{
+    // a full block of zeros: runs are capped, so it takes several tokens
+    memset(in, 0, MAX_INPUT);
+    int zbytes = round_trip(MAX_INPUT);
+    CHECK(zbytes > 0 && zbytes <= 16);
+
+    // runs too short to elide, next to ones long enough
+    fill_text(MAX_INPUT);
+    for (int at = 100, len = 1; at + len < MAX_INPUT; at += 997, len = len % 40 + 1)
+        memset(in + at, 0, len);
+    round_trip(MAX_INPUT);
+
+    // trailing zeros and a single zero byte
+    fill_text(4096);
+    memset(in + 4000, 0, 96);
+    round_trip(4096);
+    in[0] = 0;
+    round_trip(1);
+}
+
+void test_sizes()
+{
+    int sizes[] = {0, 1, 3, 4, 5, 63, 64, 127, 128, 129, 4095, 4096, 16384, 32768, MAX_INPUT};
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        fill_text(sizes[s]);
+        round_trip(sizes[s]);
+        fill_random(sizes[s]);
+        round_trip(sizes[s]);
+    }
+
+    // text packs well; matches reach back across the whole window
+    fill_text(MAX_INPUT);
+    CHECK(round_trip(MAX_INPUT) < MAX_INPUT / 4);
+}
+
+void test_incompressible()
+{
+    fill_random(MAX_INPUT);
+    // msg_pack's cap: random data cannot save an eighth
+    CHECK(lz_compress(in, MAX_INPUT, packed, MAX_INPUT - MAX_INPUT / 8) == -1);
+    CHECK(lz_compress(in, MAX_INPUT, packed, 16) == -1);
+    CHECK(round_trip(MAX_INPUT) > MAX_INPUT);
+}
+
+void test_corrupt()
+{
+    fill_text(4096);
+    memset(in + 1000, 0, 500);
+    int zbytes = lz_compress(in, 4096, packed, sizeof(packed));
+    CHECK(zbytes > 0);
+
+    // a cut stream never claims the whole payload
+    for (int k = 0; k < zbytes; k++)
+        CHECK(lz_decompress(packed, k, out, 4096) < 4096);
+
+    char bad[8];
+    bad[0] = 0x05; // literal run of 6 with 2 bytes behind it
+    bad[1] = bad[2] = 'x';
+    CHECK(lz_decompress(bad, 3, out, sizeof(out)) == -1);
+
+    bad[0] = 0x00; // one literal, then a match at distance 0
+    bad[1] = 'a';
+    bad[2] = 0x80;
+    bad[3] = bad[4] = 0;
+    CHECK(lz_decompress(bad, 5, out, sizeof(out)) == -1);
+
+    bad[3] = 2; // distance before the start of the output
+    CHECK(lz_decompress(bad, 5, out, sizeof(out)) == -1);
+
+    bad[0] = 0x80; // a match missing its distance
+    CHECK(lz_decompress(bad, 2, out, sizeof(out)) == -1);
+
+    bad[0] = 0xc0; // a zero run missing its length byte
+    CHECK(lz_decompress(bad, 1, out, sizeof(out)) == -1);
+
+    bad[0] = 0xff; // a zero run longer than the room left
+    bad[1] = 0xff;
+    CHECK(lz_decompress(bad, 2, out, 4096) == -1);
+
+    // garbage never writes past the cap
+    srand(34);
+    for (int round = 0; round < 2000; round++)
+    {
+        int n = rand() % 256;
+        fill_random(n);
+        memset(out, 0x5a, sizeof(out));
+        int len = lz_decompress(in, n, out, 1024);
+        CHECK(len >= -1 && len <= 1024);
+        CHECK(out[1024] == 0x5a);
+    }
+}
+
+void test_msg_pack()
+{
+    lz_adapt_t adapt = {0, 0};
+
+    fill_text(4096);
+    memset(&msg, 0, sizeof(msg));
+    memcpy(msg.buffer, in, 4096);
+    CHECK(msg_pack(&msg, 4096, &adapt) == LZ_PACKED);
+    CHECK(msg.flags & MSG_COMPRESSED);
+    CHECK(msg.zbytes > 0 && msg.zbytes < 4096);
+    CHECK(msg_unpack(&msg, 4096) == 0);
+    CHECK(!(msg.flags & MSG_COMPRESSED));
+    CHECK(memcmp(msg.buffer, in, 4096) == 0);
+
+    // a raw payload unpacks as itself
+    CHECK(msg_unpack(&msg, 4096) == 0);
+    CHECK(memcmp(msg.buffer, in, 4096) == 0);
+
+    // small payloads are not tried
+    CHECK(msg_pack(&msg, LZ_MIN_INPUT - 1, &adapt) == LZ_SKIPPED);
+
+    // a miss sends the next payloads raw without trying, for longer each time
+    fill_random(4096);
+    memcpy(msg.buffer, in, 4096);
+    CHECK(msg_pack(&msg, 4096, &adapt) == LZ_RAW);
+    CHECK(!(msg.flags & MSG_COMPRESSED));
+    CHECK(memcmp(msg.buffer, in, 4096) == 0);
+    CHECK(adapt.skip == 1);
+    CHECK(msg_pack(&msg, 4096, &adapt) == LZ_SKIPPED);
+    CHECK(msg_pack(&msg, 4096, &adapt) == LZ_RAW);
+    CHECK(adapt.skip == 2);
+
+    // corrupt headers and payloads are rejected
+    fill_text(4096);
+    memcpy(msg.buffer, in, 4096);
+    adapt.skip = 0;
+    CHECK(msg_pack(&msg, 4096, &adapt) == LZ_PACKED);
+    int zbytes = msg.zbytes;
+    msg.zbytes = -1;
+    CHECK(msg_unpack(&msg, 4096) == -1);
+    msg.zbytes = sizeof(msg.buffer) + 1;
+    CHECK(msg_unpack(&msg, 4096) == -1);
+    msg.zbytes = zbytes - 1;
+    CHECK(msg_unpack(&msg, 4096) == -1);
+    msg.zbytes = zbytes;
+    CHECK(msg_unpack(&msg, 4095) == -1); // not the size the request named
+    CHECK(msg_unpack(&msg, 4096) == 0);
+    CHECK(memcmp(msg.buffer, in, 4096) == 0);
+}
+
+int main()
+{
+    srand(1);
+    test_zero_runs();
+    test_sizes();
+    test_incompressible();
+    test_corrupt();
+    test_msg_pack();
+
+    printf("test_lz: %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures != 0;
+}
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "mfs.h"
+#include "server_core.h"
+
+char *mkfs_path = "./mkfs";
+char *mfsck_path = "./mfsck";
+char path[64];
+int failures;
+
+#define CHECK(cond)                                                             \
+    do                                                                          \
+    {                                                                           \
+        if (!(cond))                                                            \
+        {                                                                       \
+            fprintf(stderr, "test_mfsck: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+// runs `argv` with stdout discarded; returns its exit code, or -1
+int run(char *argv[])
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execv(argv[0], argv);
+        perror("execv");
+        _exit(127);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// a fresh image, loaded into the server core
+int open_image(char *bs, int ext)
+{
+    snprintf(path, sizeof(path), "/tmp/mfs-test-fsck-%d.img", getpid());
+    char *argv[] = {mkfs_path, "-f", path, "-d", "256", "-b", bs, ext ? "-x" : NULL, NULL};
+    if (run(argv) != 0 || server_load_image(path) != 0)
+    {
+        fprintf(stderr, "test_mfsck: no %s-byte image\n", bs);
+        failures++;
+        return -1;
+    }
+    return 0;
+}
+
+void close_image()
+{
+    int rc = save_server_file();
+    CHECK(rc == 0);
+    server_close_image();
+}
+
+int fsck(int repair)
+{
+    char *argv[] = {mfsck_path, "-j", "2", repair ? "-r" : path, repair ? path : NULL, NULL};
+    return run(argv);
+}
+
+int create(int pinum, int type, char *name)
+{
+    int rc = server_create(pinum, type, name);
+    CHECK(rc == 0);
+    return server_lookup(pinum, name);
+}
+
+void fill(char *buf, int n, int seed)
+{
+    for (int i = 0; i < n; i++)
+        buf[i] = (char)(seed + i * 13);
+}
+
+// a block written over and over keeps the file at one block: the image is
+// clean, and so it stays after a clone and a copy-on-write
+void test_rewritten(char *bs_arg, int ext)
+{
+    if (open_image(bs_arg, ext) < 0)
+        return;
+    int bs = block_size;
+    char *buf = malloc(bs);
+
+    int f = create(0, MFS_REGULAR_FILE, "f");
+    for (int pass = 0; pass < 40; pass++)
+    {
+        fill(buf, bs, pass);
+        int rc = server_write(f, buf, 0, bs);
+        CHECK(rc == 0);
+    }
+    CHECK(server_stat(f).size == bs);
+
+    int g = create(0, MFS_REGULAR_FILE, "g");
+    for (int pass = 0; pass < 10; pass++)
+    {
+        int rc = server_write(g, buf, bs, 100);
+        CHECK(rc == 0);
+        rc = server_write(g, buf, 0, 100);
+        CHECK(rc == 0);
+    }
+    CHECK(server_stat(g).size == bs + 100);
+
+    if (ext)
+    {
+        int c = create(0, MFS_REGULAR_FILE, "c");
+        int rc = server_copy(f, c, 0, bs, 1);
+        CHECK(rc == 0);
+        for (int pass = 0; pass < 10; pass++)
+        {
+            rc = server_write(c, buf, 0, bs);
+            CHECK(rc == 0);
+        }
+        CHECK(server_stat(c).size == bs);
+    }
+    close_image();
+
+    CHECK(fsck(0) == 0);
+    free(buf);
+    unlink(path);
+}
+
+// sizes past a file's blocks are cut back, and the file and its data stay
+void test_oversize(char *bs_arg, int ext)
+{
+    if (open_image(bs_arg, ext) < 0)
+        return;
+    int bs = block_size;
+    char *buf = malloc(bs);
+    char *back = malloc(bs);
+
+    int f = create(0, MFS_REGULAR_FILE, "f");
+    fill(buf, bs, 7);
+    int rc = server_write(f, buf, 0, bs);
+    CHECK(rc == 0);
+    int n = create(0, MFS_REGULAR_FILE, "n");
+    inode_area[f].size = 163840 > 3 * bs ? 163840 : 3 * bs; // as rewrites once left it
+    if (!ext)
+        inode_area[f].size = (max_file_blocks + 2) * bs;
+    inode_area[n].size = -5;
+    close_image();
+
+    CHECK(fsck(0) == 4);
+    CHECK(fsck(1) == 1);
+    CHECK(fsck(0) == 0);
+
+    if (server_load_image(path) != 0)
+    {
+        failures++;
+        return;
+    }
+    CHECK(server_lookup(0, "f") == f && server_lookup(0, "n") == n);
+    CHECK(server_stat(f).type == MFS_REGULAR_FILE);
+    CHECK(server_stat(f).size == (ext ? bs : max_file_blocks * bs));
+    CHECK(server_stat(n).size == 0);
+    rc = server_read(f, back, 0, bs);
+    CHECK(rc == 0);
+    CHECK(memcmp(buf, back, bs) == 0);
+    server_close_image();
+
+    free(buf);
+    free(back);
+    unlink(path);
+}
+
+// a file pointing at one block twice is caught, whichever clone of it
+// shares the block, and repair keeps the first pointer
+void test_dup_in_clone()
+{
+    if (open_image("4096", 1) < 0)
+        return;
+    int bs = block_size;
+    char *buf = malloc(2 * bs);
+    char *back = malloc(2 * bs);
+
+    int a = create(0, MFS_REGULAR_FILE, "a");
+    fill(buf, 2 * bs, 5);
+    int rc = server_write(a, buf, 0, bs);
+    CHECK(rc == 0);
+    rc = server_write(a, buf + bs, bs, bs);
+    CHECK(rc == 0);
+    int b = create(0, MFS_REGULAR_FILE, "b");
+    int c = create(0, MFS_REGULAR_FILE, "c");
+    rc = server_copy(a, b, 0, 2 * bs, 1);
+    CHECK(rc == 0);
+    rc = server_copy(a, c, 0, 2 * bs, 1);
+    CHECK(rc == 0);
+    inode_area[b].direct[1] = inode_area[b].direct[0];
+    close_image();
+
+    for (int round = 0; round < 20; round++)
+        CHECK(fsck(0) == 4);
+    CHECK(fsck(1) == 1);
+    CHECK(fsck(0) == 0);
+
+    if (server_load_image(path) != 0)
+    {
+        failures++;
+        return;
+    }
+    CHECK(server_stat(b).size == bs);
+    rc = server_read(b, back, 0, bs);
+    CHECK(rc == 0 && memcmp(buf, back, bs) == 0);
+    rc = server_read(a, back, 0, bs);
+    CHECK(rc == 0);
+    rc = server_read(a, back + bs, bs, bs);
+    CHECK(rc == 0 && memcmp(buf, back, 2 * bs) == 0);
+    server_close_image();
+
+    free(buf);
+    free(back);
+    unlink(path);
+}
+
+// an image damaged in several ways at once: -r repairs it, what was reachable
+// survives, and the result checks clean
+void test_repair()
+{
+    if (open_image("4096", 0) < 0)
+        return;
+    char buf[MFS_BLOCK_SIZE], back[MFS_BLOCK_SIZE];
+
+    int a = create(0, MFS_REGULAR_FILE, "a");
+    int d = create(0, MFS_DIRECTORY, "d");
+    int e = create(d, MFS_REGULAR_FILE, "e");
+    int lost = create(d, MFS_REGULAR_FILE, "lost");
+    fill(buf, sizeof(buf), 3);
+    int rc = server_write(a, buf, 0, sizeof(buf));
+    CHECK(rc == 0);
+    rc = server_write(e, buf, MFS_BLOCK_SIZE, sizeof(buf));
+    CHECK(rc == 0);
+
+    unsigned int *inode_bitmap = block_addr_to_addr(superblock_addr->inode_bitmap_addr);
+    unsigned int *data_bitmap = block_addr_to_addr(superblock_addr->data_bitmap_addr);
+    set_ith_bit(data_bitmap, superblock_addr->num_data - 1, 1); // leaked block
+    set_ith_bit(inode_bitmap, lost, 0);                         // dangling entry
+    set_ith_bit(inode_bitmap, superblock_addr->num_inodes - 1, 1); // orphan
+    inode_area[d].size += sizeof(dir_ent_t);                    // wrong directory size
+    inode_area[a].direct[5] = superblock_addr->data_region_addr + superblock_addr->num_data; // not a data block
+    close_image();
+
+    CHECK(fsck(0) == 4);
+    CHECK(fsck(1) == 1);
+    CHECK(fsck(0) == 0);
+
+    if (server_load_image(path) != 0)
+    {
+        failures++;
+        return;
+    }
+    CHECK(server_lookup(0, "a") == a);
+    CHECK(server_lookup(0, "d") == d && server_lookup(d, "e") == e);
+    CHECK(server_lookup(d, "lost") == -1);
+    CHECK(server_stat(d).size == 3 * (int)sizeof(dir_ent_t));
+    rc = server_read(a, back, 0, sizeof(back));
+    CHECK(rc == 0 && memcmp(buf, back, sizeof(buf)) == 0);
+    rc = server_read(e, back, MFS_BLOCK_SIZE, sizeof(back));
+    CHECK(rc == 0 && memcmp(buf, back, sizeof(buf)) == 0);
+    server_close_image();
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        mkfs_path = argv[1];
+    if (argc > 2)
+        mfsck_path = argv[2];
+
+    test_rewritten("4096", 0);
+    test_rewritten("4096", 1);
+    test_rewritten("65536", 1);
+    test_oversize("4096", 0);
+    test_oversize("4096", 1);
+    test_oversize("65536", 1);
+    test_dup_in_clone();
+    test_repair();
+
+    printf("test_mfsck: %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures != 0;
+}
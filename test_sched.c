@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "mfs.h"
+#include "sched.h"
+
+#define BUSY_REPLIES 2
+#define BUSY_RETRY_MS 20
+
+int failures;
+
+#define CHECK(cond)                                                             \
+    do                                                                          \
+    {                                                                           \
+        if (!(cond))                                                            \
+        {                                                                       \
+            fprintf(stderr, "test_sched: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+MSG_t msg;
+
+struct sockaddr_in client(int n)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0x7f000001);
+    addr.sin_port = htons(20000 + n);
+    return addr;
+}
+
+int enqueue(int n, int msg_type, int nbytes, int seq)
+{
+    struct sockaddr_in addr = client(n);
+    memset(&msg, 0, MSG_HEADER_SIZE);
+    msg.msg_type = msg_type;
+    msg.nbytes = nbytes;
+    msg.seq = seq;
+    return sched_enqueue(&addr, &msg, msg_request_size(&msg), 0);
+}
+
+int client_of(sched_entry_t *e)
+{
+    return ntohs(e->addr.sin_port) - 20000;
+}
+
+void drain()
+{
+    sched_entry_t *e;
+    while ((e = sched_next()) != NULL)
+        sched_done(e, 0);
+    CHECK(sched_queued() == 0);
+}
+
+// two clients flooding the same class take equal turns, whatever their depth,
+// and each client's requests come out in the order they went in
+void test_flow_fairness()
+{
+    for (int i = 0; i < SCHED_FLOW_DEPTH; i++)
+    {
+        CHECK(enqueue(1, WRITE_t, MFS_BLOCK_SIZE, i) == 0);
+        if (i < 8)
+            CHECK(enqueue(2, WRITE_t, MFS_BLOCK_SIZE, i) == 0);
+    }
+
+    int served[3] = {0, 0, 0};
+    int last_seq[3] = {-1, -1, -1};
+    for (int i = 0; i < 16; i++)
+    {
+        sched_entry_t *e = sched_next();
+        CHECK(e != NULL);
+        if (e == NULL)
+            break;
+        int n = client_of(e);
+        CHECK(e->msg->seq == last_seq[n] + 1);
+        last_seq[n] = e->msg->seq;
+        served[n]++;
+        sched_done(e, 0);
+    }
+    CHECK(served[1] == 8 && served[2] == 8);
+    drain();
+}
+
+// clients are charged for the bytes they move: small reads get through
+// many times for each large write
+void test_byte_fairness()
+{
+    for (int i = 0; i < SCHED_FLOW_DEPTH; i++)
+    {
+        CHECK(enqueue(1, WRITE_t, 16384, i) == 0);
+        CHECK(enqueue(2, READ_t, 256, i) == 0);
+    }
+
+    long long bytes[3] = {0, 0, 0};
+    int served[3] = {0, 0, 0};
+    while (served[1] < 3)
+    {
+        sched_entry_t *e = sched_next();
+        CHECK(e != NULL);
+        if (e == NULL)
+            break;
+        int n = client_of(e);
+        bytes[n] += e->nbytes + (e->msg->msg_type == READ_t ? e->msg->nbytes : 0);
+        served[n]++;
+        sched_done(e, 0);
+    }
+    CHECK(served[2] >= 2 * SCHED_FLOW_DEPTH / 3);
+    CHECK(bytes[2] * 2 >= bytes[1] / 2);
+    drain();
+}
+
+// a client flooding data requests does not starve another's metadata ones
+void test_class_fairness()
+{
+    CHECK(sched_set_weights("2:1") == 0);
+    for (int i = 0; i < SCHED_FLOW_DEPTH; i++)
+        CHECK(enqueue(1, WRITE_t, MFS_BLOCK_SIZE, i) == 0);
+    for (int i = 0; i < 8; i++)
+        CHECK(enqueue(2, LOOKUP_t, 0, i) == 0);
+
+    int meta_done_at = -1;
+    int meta = 0;
+    for (int i = 0; i < SCHED_FLOW_DEPTH + 8; i++)
+    {
+        sched_entry_t *e = sched_next();
+        CHECK(e != NULL);
+        if (e == NULL)
+            break;
+        if (client_of(e) == 2 && ++meta == 8)
+            meta_done_at = i;
+        sched_done(e, 0);
+    }
+    // every lookup is through before the writes are half done
+    CHECK(meta_done_at >= 0 && meta_done_at < SCHED_FLOW_DEPTH / 2);
+    CHECK(sched_queued() == 0);
+
+    CHECK(sched_set_weights("0:1") == -1);
+    CHECK(sched_set_weights("4") == -1);
+}
+
+// full queues turn requests away instead of growing; the client is told to
+// come back later, and the queues take requests again once drained
+void test_backpressure()
+{
+    for (int i = 0; i < SCHED_FLOW_DEPTH; i++)
+        CHECK(enqueue(1, READ_t, MFS_BLOCK_SIZE, i) == 0);
+    CHECK(enqueue(1, READ_t, MFS_BLOCK_SIZE, SCHED_FLOW_DEPTH) == -1);
+    CHECK(enqueue(1, STAT_t, 0, 0) == 0); // the other class has its own queue
+    CHECK(sched_queued() == SCHED_FLOW_DEPTH + 1);
+
+    // the shared pool runs out across clients; those turned away hold nothing
+    int accepted = 0;
+    for (int n = 2; n < 2 * SCHED_FLOWS; n++)
+    {
+        for (int i = 0; i < 4; i++)
+            accepted += enqueue(n, LOOKUP_t, 0, i) == 0;
+    }
+    CHECK(sched_queued() == SCHED_MAX_QUEUED);
+    CHECK(accepted == SCHED_MAX_QUEUED - SCHED_FLOW_DEPTH - 1);
+    CHECK(enqueue(3 * SCHED_FLOWS, LOOKUP_t, 0, 0) == -1);
+
+    for (int i = 0; i < 8; i++)
+    {
+        sched_entry_t *e = sched_next();
+        CHECK(e != NULL);
+        if (e != NULL)
+            sched_done(e, 1000000); // 1 ms each
+    }
+    int retry = sched_retry_after_ms();
+    CHECK(retry >= 1 && retry <= 1000);
+    CHECK(enqueue(3 * SCHED_FLOWS, LOOKUP_t, 0, 0) == 0);
+
+    drain();
+    CHECK(sched_retry_after_ms() == 1);
+
+    // every flow is free again, whoever was turned away
+    accepted = 0;
+    for (int n = 0; n < SCHED_FLOWS; n++)
+        accepted += enqueue(4 * SCHED_FLOWS + n, STAT_t, 0, 0) == 0;
+    CHECK(accepted == SCHED_FLOWS);
+    drain();
+}
+
+// a server that turns the first requests away with MSG_BUSY
+int busy_port;
+int busy_requests;
+
+void *busy_server(void *arg)
+{
+    int sd = *(int *)arg;
+    MSG_t request, response;
+    struct sockaddr_in addr;
+    while (1)
+    {
+        if (UDP_Read(sd, &addr, (char *)&request, sizeof(request)) <= 0)
+            continue;
+        memset(&response, 0, MSG_HEADER_SIZE);
+        response.seq = request.seq;
+        if (busy_requests++ < BUSY_REPLIES)
+        {
+            response.rc = -1;
+            response.flags = MSG_BUSY;
+            response.offset = BUSY_RETRY_MS;
+        }
+        else
+        {
+            response.rc = 0;
+            response.type = MFS_DIRECTORY;
+            response.nbytes = 4096;
+        }
+        UDP_Write(sd, &addr, (char *)&response, MSG_HEADER_SIZE);
+        if (request.msg_type == SHUTDOWN_t)
+            break;
+    }
+    return NULL;
+}
+
+long long now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+void test_client_busy()
+{
+    int sd = -1;
+    for (busy_port = 21000; busy_port < 21100 && sd < 0; busy_port++)
+        sd = UDP_Open(busy_port);
+    busy_port--;
+    CHECK(sd >= 0);
+    if (sd < 0)
+        return;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, busy_server, &sd);
+
+    setenv("MFS_NO_SHM", "1", 1);
+    CHECK(MFS_Init("localhost", busy_port) == 0);
+    MFS_Stat_t m;
+    long long start = now_ms();
+    CHECK(MFS_Stat(0, &m) == 0);
+    long long elapsed = now_ms() - start;
+
+    // retried after each busy reply, waiting at least as long as told to
+    CHECK(busy_requests == BUSY_REPLIES + 1);
+    CHECK(m.type == MFS_DIRECTORY && m.size == 4096);
+    CHECK(elapsed >= BUSY_REPLIES * BUSY_RETRY_MS);
+
+    MFS_Shutdown();
+    pthread_join(tid, NULL);
+    UDP_Close(sd);
+}
+
+int main()
+{
+    sched_init();
+    test_flow_fairness();
+    test_byte_fairness();
+    test_class_fairness();
+    test_backpressure();
+    test_client_busy();
+
+    printf("test_sched: %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures != 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "mfs.h"
+#include "server_core.h"
+
+char *mkfs_path = "./mkfs";
+int failures;
+
+#define CHECK(cond)                                                              \
+    do                                                                           \
+    {                                                                            \
+        if (!(cond))                                                             \
+        {                                                                        \
+            fprintf(stderr, "test_server: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                          \
+        }                                                                        \
+    } while (0)
+
+// a fresh image at `path`; `ext` and `bs` as mkfs -x and -b
+int make_image(char *path, int ext, int bs)
+{
+    char bs_arg[16];
+    sprintf(bs_arg, "%d", bs);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        if (ext)
+            execl(mkfs_path, mkfs_path, "-f", path, "-d", "256", "-b", bs_arg, "-x", (char *)NULL);
+        else
+            execl(mkfs_path, mkfs_path, "-f", path, "-d", "256", "-b", bs_arg, (char *)NULL);
+        perror("execl");
+        _exit(1);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int create(char *name)
+{
+    int rc = server_create(0, MFS_REGULAR_FILE, name);
+    CHECK(rc == 0);
+    return server_lookup(0, name);
+}
+
+// a file's size is the end of its furthest write: rewrites, shorter
+// overwrites and rejected writes leave it alone
+void test_write_size(int ext, int bs)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mfs-test-server-%d.img", getpid());
+    if (make_image(path, ext, bs) < 0 || server_load_image(path) != 0)
+    {
+        fprintf(stderr, "test_server: no %d-byte image\n", bs);
+        failures++;
+        return;
+    }
+
+    char *block = malloc(bs);
+    char *back = malloc(bs);
+    for (int i = 0; i < bs; i++)
+        block[i] = (char)(i * 7 + 1);
+
+    int f = create("f");
+    int rc = server_write(f, block, 0, 100);
+    CHECK(rc == 0);
+    CHECK(server_stat(f).size == 100);
+    for (int pass = 0; pass < 10; pass++)
+    {
+        rc = server_write(f, block, 0, 100);
+        CHECK(rc == 0);
+    }
+    CHECK(server_stat(f).size == 100);
+    rc = server_write(f, block, 0, 50);
+    CHECK(rc == 0);
+    CHECK(server_stat(f).size == 100);
+
+    // appending a block grows the file to its end, and so does a write past it
+    rc = server_write(f, block, bs, bs);
+    CHECK(rc == 0);
+    CHECK(server_stat(f).size == 2 * bs);
+    rc = server_write(f, block, 0, bs);
+    CHECK(rc == 0);
+    CHECK(server_stat(f).size == 2 * bs);
+    rc = server_read(f, back, bs, bs);
+    CHECK(rc == 0 && memcmp(block, back, bs) == 0);
+
+    int g = create("g");
+    rc = server_write(g, block, 3 * bs, 100);
+    CHECK(rc == 0);
+    CHECK(server_stat(g).size == 3 * bs + 100);
+    rc = server_write(g, block, bs, 100);
+    CHECK(rc == 0);
+    CHECK(server_stat(g).size == 3 * bs + 100);
+
+    // out of range writes fail and change nothing
+    CHECK(server_write(g, block, max_file_blocks * bs, 100) == -1);
+    CHECK(server_write(g, block, -1, 100) == -1);
+    CHECK(server_write(g, block, 0, -1) == -1);
+    CHECK(server_stat(g).size == 3 * bs + 100);
+
+    if (bs > MFS_BLOCK_SIZE)
+    {
+        // writes inside a large block land where asked
+        int h = create("h");
+        rc = server_write(h, block, 20, 10);
+        CHECK(rc == 0);
+        CHECK(server_stat(h).size == 30);
+        rc = server_write(h, block, 5, 10);
+        CHECK(rc == 0);
+        CHECK(server_stat(h).size == 30);
+        CHECK(server_write(h, block, bs - 5, 10) == -1); // crosses a block
+        CHECK(server_stat(h).size == 30);
+    }
+
+    free(block);
+    free(back);
+    server_close_image();
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        mkfs_path = argv[1];
+
+    test_write_size(0, 4096);
+    test_write_size(1, 4096);
+    test_write_size(1, 65536);
+
+    printf("test_server: %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures != 0;
+}
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+// one ring per thread; only the owning thread writes records and `head`,
+// so recording never takes a lock. Rings are pushed onto a global list once
+// and never freed, so a dump can walk them from any thread or a signal handler.
+// Short-lived threads (shm sessions) instead share one ring under a lock, so
+// each of them does not leave a ring behind when it exits.
+typedef struct __trace_ring_t {
+    struct __trace_ring_t *next;
+    int tid;
+    unsigned long long head; // records ever written
+    trace_rec_t recs[TRACE_RING_SIZE];
+} trace_ring_t;
+
+volatile int trace_level = TRACE_INFO;
+char trace_path[256] = "mfs-server.trace";
+
+static trace_ring_t *trace_rings;
+static __thread trace_ring_t *my_ring;
+static __thread int my_tid;
+static __thread int my_ring_shared;
+
+static trace_ring_t *shared_ring;
+static pthread_mutex_t shared_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static trace_ring_t *trace_new_ring(int tid)
+{
+    trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+    if (ring == NULL)
+        return NULL;
+    ring->tid = tid;
+
+    trace_ring_t *head = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+    do
+    {
+        ring->next = head;
+    } while (!__atomic_compare_exchange_n(&trace_rings, &head, ring, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    return ring;
+}
+
+static trace_ring_t *trace_get_ring()
+{
+    if (my_ring != NULL)
+        return my_ring;
+
+    my_tid = syscall(SYS_gettid);
+    my_ring = trace_new_ring(my_tid);
+    return my_ring;
+}
+
+// records from the calling thread go to the shared ring (tid 0 in dumps);
+// each record still carries the thread's own tid
+void trace_share_ring()
+{
+    pthread_mutex_lock(&shared_ring_lock);
+    if (shared_ring == NULL)
+        shared_ring = trace_new_ring(0);
+    pthread_mutex_unlock(&shared_ring_lock);
+
+    my_tid = syscall(SYS_gettid);
+    my_ring = shared_ring;
+    my_ring_shared = shared_ring != NULL;
+}
+
+void trace_record(int event, int op, int inum, int rc, int arg, unsigned long long dur_ns)
+{
+    trace_ring_t *ring = trace_get_ring();
+    if (ring == NULL)
+        return;
+    if (my_ring_shared)
+        pthread_mutex_lock(&shared_ring_lock);
+
+    unsigned long long head = ring->head;
+    trace_rec_t *rec = &ring->recs[head & (TRACE_RING_SIZE - 1)];
+    rec->ts_ns = trace_now_ns();
+    rec->dur_ns = dur_ns > 0xffffffffULL ? 0xffffffffU : (unsigned int)dur_ns;
+    rec->event = event;
+    rec->op = op;
+    rec->inum = inum;
+    rec->rc = rc;
+    rec->arg = arg;
+    rec->tid = my_tid;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    if (my_ring_shared)
+        pthread_mutex_unlock(&shared_ring_lock);
+}
+
+void trace_set_level(int level)
+{
+    trace_level = level;
+    trace_record(TRACE_LEVEL, 0, 0, 0, level, 0);
+}
+
+static void trace_signal_handler(int sig)
+{
+    trace_dump(trace_path);
+}
+
+void trace_init()
+{
+    char *level = getenv("MFS_TRACE_LEVEL");
+    if (level != NULL)
+        trace_level = atoi(level);
+
+    char *path = getenv("MFS_TRACE_FILE");
+    if (path != NULL)
+        snprintf(trace_path, sizeof(trace_path), "%s", path);
+
+    signal(SIGUSR1, trace_signal_handler);
+}
+
+// only uses async-signal-safe calls, so it can run from the SIGUSR1 handler
+int trace_dump(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0)
+        return -1;
+
+    // rings are only ever pushed at the front, so this snapshot stays valid
+    trace_ring_t *rings = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+    trace_file_hdr_t hdr = {TRACE_MAGIC, 1, 0, 0};
+    for (trace_ring_t *ring = rings; ring != NULL; ring = ring->next)
+        hdr.nrings++;
+
+    struct timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    hdr.realtime_offset_ns = (real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+    write(fd, &hdr, sizeof(hdr));
+
+    for (trace_ring_t *ring = rings; ring != NULL; ring = ring->next)
+    {
+        unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        unsigned long long n = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+        trace_ring_hdr_t ring_hdr = {ring->tid, (int)n, head - n};
+        write(fd, &ring_hdr, sizeof(ring_hdr));
+
+        // oldest record first, in at most two contiguous pieces
+        unsigned long long first = (head - n) & (TRACE_RING_SIZE - 1);
+        unsigned long long tail = first + n > TRACE_RING_SIZE ? TRACE_RING_SIZE - first : n;
+        write(fd, &ring->recs[first], tail * sizeof(trace_rec_t));
+        write(fd, &ring->recs[0], (n - tail) * sizeof(trace_rec_t));
+    }
+
+    close(fd);
+    return 0;
+}
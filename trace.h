@@ -0,0 +1,83 @@
+#ifndef __TRACE_h__
+#define __TRACE_h__
+
+#include <stdio.h>
+#include <time.h>
+
+// log levels, from quietest to loudest
+#define TRACE_OFF (0)
+#define TRACE_ERROR (1) // error text, binary records for failed requests
+#define TRACE_INFO (2)  // binary record for every request
+#define TRACE_DEBUG (3) // per-request text on stdout as well
+
+// binary record events
+#define TRACE_REQUEST (1) // op handled: op, inum, rc, arg = nbytes
+#define TRACE_DUP (2)     // duplicate request: op, arg = seq
+#define TRACE_SAVE (3)    // image written back: arg = blocks
+#define TRACE_LEVEL (4)   // level changed: arg = new level
+#define TRACE_BUSY (5)    // turned away, queues full: op, inum, rc = queued, arg = seq
+#define TRACE_CHECKPOINT (6) // snapshot forked: rc = child pid, arg = dirty KB, dur = pause
+
+#define TRACE_RING_SIZE (1 << 16) // records per thread, power of two
+#define TRACE_MAGIC "MFSTRACE"
+
+typedef struct {
+    unsigned long long ts_ns; // CLOCK_MONOTONIC
+    unsigned int dur_ns;
+    unsigned short event;
+    unsigned short op;
+    int inum;
+    int rc;
+    int arg;
+    int tid;
+} trace_rec_t;
+
+// dump file layout: header, then per ring a trace_ring_hdr_t and its records
+// (oldest first)
+typedef struct {
+    char magic[8];
+    int version;
+    int nrings;
+    long long realtime_offset_ns; // add to ts_ns for wall-clock time
+} trace_file_hdr_t;
+
+typedef struct {
+    int tid;
+    int nrecs;
+    unsigned long long dropped; // overwritten before the dump
+} trace_ring_hdr_t;
+
+extern volatile int trace_level;
+extern char trace_path[256];
+
+static inline unsigned long long trace_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// both macros cost one predictable branch while their level is disabled
+#define LOG(level, ...)                    \
+    do                                     \
+    {                                      \
+        if (trace_level >= (level))        \
+            printf(__VA_ARGS__);           \
+    } while (0)
+
+#define TRACE(level, event, op, inum, rc, arg, dur_ns)                 \
+    do                                                                 \
+    {                                                                  \
+        if (trace_level >= (level))                                    \
+            trace_record((event), (op), (inum), (rc), (arg), (dur_ns)); \
+    } while (0)
+
+void trace_init();
+void trace_set_level(int level);
+void trace_share_ring();
+void trace_record(int event, int op, int inum, int rc, int arg, unsigned long long dur_ns);
+int trace_dump(const char *path);
+
+int MFS_Trace(int level, int dump);
+
+#endif // __TRACE_h__
@@ -4,10 +4,23 @@
 #define UFS_DIRECTORY (0)
 #define UFS_REGULAR_FILE (1)
 
-#define UFS_BLOCK_SIZE (4096)
+#define UFS_BLOCK_SIZE (4096)       // classic images
+#define UFS_MAX_BLOCK_SIZE (65536)  // mkfs -b: a power of two up to this
 
 #define DIRECT_PTRS (30)
 
+// extended images (mkfs -x): direct[28] points at a block of block
+// pointers, direct[29] at a block of pointers to such blocks
+#define EXT_DIRECT_PTRS (28)
+#define EXT_SINGLE (28)
+#define EXT_DOUBLE (29)
+#define INDIRECT_PTRS(block_size) ((block_size) / (int)sizeof(unsigned int))
+#define EXT_MAX_BLOCKS(block_size) (0x7fffffff / (block_size)) // sizes are ints
+
+#define UFS_MAGIC (0x4d465358) // "MFSX"
+#define UFS_FEATURE_INDIRECT (0x1)
+#define UFS_FEATURE_BLOCK_SIZE (0x2) // block_size below, else UFS_BLOCK_SIZE
+
 typedef struct {
     int type;   // MFS_DIRECTORY or MFS_REGULAR
     int size;   // bytes
@@ -31,6 +44,11 @@ typedef struct __super {
     int data_region_len;   // in blocks
     int num_inodes;        // just the number of inodes
     int num_data;          // and data blocks...
+    // zero on classic images, whose superblock ends above
+    int magic;             // UFS_MAGIC
+    int version;
+    int features;          // UFS_FEATURE_*
+    int block_size;        // in bytes, with UFS_FEATURE_BLOCK_SIZE
 } super_t;
 
 
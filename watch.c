@@ -0,0 +1,108 @@
+#include "watch.h"
+#include "trace.h"
+
+typedef struct
+{
+    struct sockaddr_in addr;
+    int pinum;
+    int seq; // of the last event sent
+    unsigned long long expires_ns; // 0: slot unused
+} watch_t;
+
+watch_t watches[WATCH_MAX];
+int watch_top = 0; // slots at and above this were never used
+int watch_sd = -1;
+
+void watch_init(int sd)
+{
+    watch_sd = sd;
+}
+
+int watch_live(watch_t *w, unsigned long long now)
+{
+    if (w->expires_ns != 0 && w->expires_ns <= now)
+    {
+        LOG(TRACE_DEBUG, "server:: watch on %d expired\n", w->pinum);
+        w->expires_ns = 0;
+    }
+    return w->expires_ns != 0;
+}
+
+int watch_add(struct sockaddr_in *addr, int pinum, int ttl_ms, int *created)
+{
+    unsigned long long now = trace_now_ns();
+    watch_t *free_slot = NULL;
+    *created = 0;
+
+    if (ttl_ms == 0)
+        ttl_ms = WATCH_TTL_MS;
+    if (ttl_ms > WATCH_MAX_TTL_MS)
+        ttl_ms = WATCH_MAX_TTL_MS;
+
+    for (int i = 0; i < watch_top; i++)
+    {
+        watch_t *w = &watches[i];
+        if (!watch_live(w, now))
+        {
+            if (free_slot == NULL)
+                free_slot = w;
+            continue;
+        }
+        if (w->pinum == pinum && w->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            w->addr.sin_port == addr->sin_port)
+        {
+            if (ttl_ms < 0)
+            {
+                w->expires_ns = 0;
+                return 0;
+            }
+            w->expires_ns = now + ttl_ms * 1000000ULL;
+            return w->seq;
+        }
+    }
+
+    if (ttl_ms < 0)
+        return 0; // nothing to remove
+    if (free_slot == NULL && watch_top < WATCH_MAX)
+        free_slot = &watches[watch_top++];
+    if (free_slot == NULL)
+        return -1;
+
+    free_slot->addr = *addr;
+    free_slot->pinum = pinum;
+    free_slot->seq = 0;
+    free_slot->expires_ns = now + ttl_ms * 1000000ULL;
+    *created = 1;
+    return 0;
+}
+
+void watch_notify(int pinum, int event, int inum, char *name)
+{
+    unsigned long long now = trace_now_ns();
+    watch_event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.msg_type = WATCH_EVENT_t;
+    ev.pinum = pinum;
+    ev.event = event;
+    ev.inum = inum;
+    snprintf(ev.name, sizeof(ev.name), "%s", name);
+
+    for (int i = 0; i < watch_top; i++)
+    {
+        watch_t *w = &watches[i];
+        if (w->pinum != pinum || !watch_live(w, now))
+            continue;
+
+        ev.seq = ++w->seq;
+        UDP_Write(watch_sd, &w->addr, (char *)&ev, sizeof(ev)); // best effort, seq shows losses
+    }
+}
+
+int watch_count()
+{
+    unsigned long long now = trace_now_ns();
+    int live = 0;
+    for (int i = 0; i < watch_top; i++)
+        live += watch_live(&watches[i], now);
+    return live;
+}
@@ -0,0 +1,24 @@
+#ifndef __WATCH_h__
+#define __WATCH_h__
+
+#include "udp.h"
+#include "msg.h"
+
+#define WATCH_MAX (1024)          // registrations across all clients
+#define WATCH_TTL_MS (30000)      // when the client does not ask for another
+#define WATCH_MAX_TTL_MS (300000)
+
+// A registration is a directory inum plus the client address events go to.
+// Each one numbers its events, so a client can tell that datagrams were lost.
+void watch_init(int sd);
+
+// adds or renews; returns the registration's last event seq (and *created),
+// or -1 when the table is full. ttl_ms < 0 removes it instead.
+int watch_add(struct sockaddr_in *addr, int pinum, int ttl_ms, int *created);
+
+// sends a watch_event_t to every live registration on `pinum`
+void watch_notify(int pinum, int event, int inum, char *name);
+
+int watch_count();
+
+#endif // __WATCH_h__